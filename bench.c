@@ -0,0 +1,85 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mpc.h"
+
+/* Times mpc_parse_pipe on generated programs of growing size, written
+ * into a pipe by a child process, using the tinylisp grammar. The time
+ * per megabyte should stay flat as the programs grow. */
+
+static void bench_write(int fd, long size) {
+  FILE* f = fdopen(fd, "w");
+  long n = 0;
+  for (long i=0; n < size; i++) {
+    n += fprintf(f, "(def {x%ld} {%ld \"s%ld\" (+ %ld -1) {a b c}}) ; %ld\n", i, i, i, i, i);
+  }
+  fclose(f);
+}
+
+int main(int argc, char** argv) {
+
+  mpc_parser_t* Number   = mpc_new("number");
+  mpc_parser_t* Symbol   = mpc_new("symbol");
+  mpc_parser_t* String   = mpc_new("string");
+  mpc_parser_t* Comment  = mpc_new("comment");
+  mpc_parser_t* Sexpr    = mpc_new("sexpr");
+  mpc_parser_t* Qexpr    = mpc_new("qexpr");
+  mpc_parser_t* Expr     = mpc_new("expr");
+  mpc_parser_t* Tinylisp = mpc_new("tinylisp");
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " \
+      number   : /-?[0-9]+/ ;                               \
+      symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;         \
+      string   : /\"(\\\\.|[^\"])*\"/ ;                     \
+      comment  : /;[^\\r\\n]*/ ;                            \
+      sexpr    : '(' <expr>* ')' ;                          \
+      qexpr    : '{' <expr>* '}' ;                          \
+      expr     : <number>  | <symbol> | <string>            \
+               | <comment> | <sexpr>  | <qexpr> ;           \
+      tinylisp : /^/ <expr>* /$/ ;                          \
+    ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Tinylisp);
+
+  int max = argc > 1 ? atoi(argv[1]) : 4;
+  puts("    MB   seconds   MB/s");
+
+  for (int mb=1; mb <= max; mb *= 2) {
+    int fds[2];
+    if (pipe(fds) != 0) return 1;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fds[0]);
+      bench_write(fds[1], (long)mb << 20);
+      _exit(0);
+    }
+    close(fds[1]);
+
+    FILE* in = fdopen(fds[0], "r");
+    mpc_result_t r;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int ok = mpc_parse_pipe("<pipe>", in, Tinylisp, &r);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    fclose(in);
+    waitpid(pid, NULL, 0);
+
+    if (!ok) {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+      return 1;
+    }
+    mpc_ast_delete(r.output);
+
+    double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%6d %9.3f %6.2f\n", mb, s, mb / s);
+  }
+
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Tinylisp);
+  return 0;
+}
@@ -1,160 +1,925 @@
 
 #include "builtins.h"
+#include "machine.h"
+#include "optimize.h"
+#include "seq.h"
+#include "memo.h"
+#include "intern.h"
+#include "macro.h"
+#include "match.h"
+#include "record.h"
+#include "cell.h"
 
-Value* builtin_op(Env* e, Value* a, char* op) {
-  for (int i=0; i < a->count; i++) {
-    if(a->cell[i]->type != TL_INTEGER) {
-      tl_val_delete(a);
-      return tl_val_error("Cannot operate on non-number");
+Builtin tl_builtins[] = {
+  { "list", builtin_list,  0, -1, "",   TL_PURE },
+  { "head", builtin_head,  1,  1, "l",  TL_PURE },
+  { "tail", builtin_tail,  1,  1, "l",  TL_PURE },
+  { "eval", builtin_eval,  1,  1, "q",  0 },
+  { "join", builtin_join,  1, -1, "q",  TL_PURE },
+
+  { "map",    builtin_map,    2, 2, "fl",  0 },
+  { "filter", builtin_filter, 2, 2, "fl",  0 },
+  { "foldl",  builtin_foldl,  3, 3, "f.l", 0 },
+  { "foldr",  builtin_foldr,  3, 3, "f.l", 0 },
+  { "reduce", builtin_reduce, 2, 2, "fl",  0 },
+  { "take",   builtin_take,   2, 2, "nl",  0 },
+
+  // Lazy sequences
+  { "range",   builtin_range,   1, 3, "n",  0 },
+  { "iterate", builtin_iterate, 2, 2, "f.", 0 },
+  { "repeat",  builtin_repeat,  1, 2, ".n", 0 },
+
+  // Memoisation
+  { "memo",       builtin_memo,       1, 2, "fn", 0 },
+  { "memo-stats", builtin_memo_stats, 1, 1, "f",  0 },
+  { "intern",     builtin_intern,     1, 1, "",   0 },
+  { "specialize", builtin_specialize, 1, -1, "f.", 0 },
+
+  // Records
+  { "defrecord",   builtin_defrecord,   2,  2, "qq",   0 },
+  { "record",      builtin_record,      1, -1, "",     TL_PURE },
+  { "record-get",  builtin_record_get,  3,  3, "..n",  TL_PURE },
+  { "record-with", builtin_record_with, 4,  4, "..n.", TL_PURE },
+  { "is-record",   builtin_record_is,   2,  2, "",     TL_PURE },
+
+  // Reactive cells
+  { "defcell",    builtin_defcell,    2, 2, "qq", 0 },
+  { "batch",      builtin_batch,      1, 1, "q",  0 },
+  { "cell-stats", builtin_cell_stats, 1, 1, "q",  0 },
+
+  // Transducers
+  { "xmap",        builtin_xmap,        1, 1, "f",    TL_PURE },
+  { "xfilter",     builtin_xfilter,     1, 1, "f",    TL_PURE },
+  { "xtake",       builtin_xtake,       1, 1, "n",    TL_PURE },
+  { "xdrop",       builtin_xdrop,       1, 1, "n",    TL_PURE },
+  { "xtake-while", builtin_xtake_while, 1, 1, "f",    TL_PURE },
+  { "xdrop-while", builtin_xdrop_while, 1, 1, "f",    TL_PURE },
+  { "transduce",   builtin_transduce,   4, 4, "qf..", 0 },
+  { "into",        builtin_into,        2, 2, "q.",   0 },
+
+#define TL_ARITH_ENTRY(name, sym, ...) { sym, builtin_##name, 1, -1, "n", TL_PURE },
+  TL_ARITH_OPS(TL_ARITH_ENTRY)
+  { "/", builtin_divide,   1, -1, "n",  TL_PURE },
+
+  { "def", builtin_def,    1, -1, "q.", 0 },
+  { "=",   builtin_put,    1, -1, "q.", 0 },
+  { "\\",  builtin_lambda, 2,  2, "qq", TL_PURE },
+  { "quote", builtin_quote, 1, 1, "",  TL_PURE },
+  { "defmacro", builtin_defmacro, 3, 3, "qqq", 0 },
+
+  // Comparison
+  { "if", builtin_if,      3,  3, "nqq", 0 },
+  { "match", builtin_match, 3, -1, "",  0 },
+  { "==", builtin_eq,      2,  2, "",   TL_PURE },
+  { "!=", builtin_ne,      2,  2, "",   TL_PURE },
+#define TL_ORD_ENTRY(name, sym, ...) { sym, builtin_##name, 2, 2, "nn", TL_PURE },
+  TL_ORD_OPS(TL_ORD_ENTRY)
+
+  // Loops
+  { "while", builtin_while, 2,  2, "qq",   0 },
+  { "for",   builtin_for,   4,  4, "qnnq", 0 },
+  { "each",  builtin_each,  3,  3, "qqq",  0 },
+
+  // Control
+  { "call/cc",   builtin_callcc,    1,  1, "f",  0 },
+  { "generator", builtin_generator, 1, -1, "f.", 0 },
+  { "next",      builtin_next,      1,  1, "g",  0 },
+  { "yield",     builtin_yield,     0,  1, "",   0 },
+  { "try",       builtin_try,       3,  3, "qqq", 0 },
+  { "throw",     builtin_throw,     1,  1, "s",  0 },
+
+  { NULL, NULL, 0, 0, NULL, 0 }
+};
+
+static int tl_builtin_type(char t) {
+  switch (t) {
+    case 'n': return TL_INTEGER;
+    case 's': return TL_STRING;
+    case 'q': return TL_QEXPR;
+    case 'l': return TL_QEXPR;
+    case 'f': return TL_FUNCTION;
+    case 'g': return TL_GENERATOR;
+    default:  return -1;
+  }
+}
+
+Value* tl_builtin_check(Builtin* b, int n, Value** a) {
+  if (n < b->min || (b->max >= 0 && n > b->max)) {
+    if (b->min == b->max) {
+      return tl_val_error(
+          "Function '%s' passed incorrect number of arguments. Got: %i, expected: %i",
+          b->name, n, b->min);
+    }
+    return tl_val_error(
+        "Function '%s' passed incorrect number of arguments. Got: %i, expected %s %i",
+        b->name, n, n < b->min ? "at least" : "at most",
+        n < b->min ? b->min : b->max);
+  }
+
+  int len = strlen(b->types);
+  for (int i=0; len && i < n; i++) {
+    char c = b->types[i < len ? i : len-1];
+    int t = tl_builtin_type(c);
+    if (t >= 0 && a[i]->type != t && !(c == 'l' && a[i]->type == TL_SEQ)) {
+      return tl_val_error(
+          "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.",
+          b->name, i, tl_type_name(a[i]->type), tl_type_name(t));
+    }
+  }
+  return NULL;
+}
+
+Value* tl_builtin_call(Env* e, Builtin* b, int n, Value** a) {
+  Value* err = tl_builtin_check(b, n, a);
+  return err ? err : b->fn(e, n, a);
+}
+
+Builtin* tl_builtin_find(tl_builtin fn) {
+  for (Builtin* b = tl_builtins; b->fn; b++) {
+    if (b->fn == fn) return b;
+  }
+  return NULL;
+}
+
+#define TL_ARITH_KERNEL(name, sym, op, unary) \
+  Value* builtin_##name(Env* e, int n, Value** a) { \
+    long x = a[0]->num; \
+    if (n == 1) return tl_val_num(unary); \
+    if (n == 2) return tl_val_num(x op a[1]->num); \
+    for (int i=1; i < n; i++) x = x op a[i]->num; \
+    return tl_val_num(x); \
+  }
+
+TL_ARITH_OPS(TL_ARITH_KERNEL)
+
+Value* builtin_divide(Env* e, int n, Value** a) {
+  long x = a[0]->num;
+  for (int i=1; i < n; i++) {
+    TL_ASSERT(a[i]->num != 0, "Divide by zero");
+    x /= a[i]->num;
+  }
+  return tl_val_num(x);
+}
+
+#define TL_ORD_KERNEL(name, sym, op) \
+  Value* builtin_##name(Env* e, int n, Value** a) { \
+    return tl_val_num(a[0]->num op a[1]->num); \
+  }
+
+TL_ORD_OPS(TL_ORD_KERNEL)
+
+static Value* tl_builtin_list(int type, int n, Value** a) {
+  Value* x = type == TL_QEXPR ? tl_val_qexpr() : tl_val_sexpr();
+  if (n == 0) return x;
+
+  x->count = n;
+  x->cell = malloc(sizeof(Value*) * n);
+  for (int i=0; i < n; i++) x->cell[i] = tl_val_copy(a[i]);
+  return x;
+}
+
+Value* builtin_list(Env* e, int n, Value** a) {
+  return tl_builtin_list(TL_QEXPR, n, a);
+}
+
+/* Forces the first node of sequence 'v' for 'head' or 'tail'. The node
+ * is held across forcing, which can run code that drops 'v'. */
+static Value* tl_builtin_uncons(Env* e, Value* v, char* fn, int rest) {
+  Seq* s = v->seq;
+  s->refs++;
+  Value* x = tl_seq_force(s, e);
+  if (!x && !s->first) x = tl_val_error("Function '%s' passed empty list", fn);
+  if (!x) {
+    if (rest) {
+      s->rest->refs++;
+      x = tl_seq_new(s->rest);
+    } else {
+      x = tl_builtin_list(TL_QEXPR, 1, &s->first);
     }
   }
+  tl_seq_release(s);
+  return x;
+}
+
+Value* builtin_head(Env* e, int n, Value** a) {
+  if (a[0]->type == TL_SEQ) return tl_builtin_uncons(e, a[0], "head", 0);
+  TL_ASSERT(a[0]->count != 0, "Function 'head' passed empty list");
+  return tl_builtin_list(TL_QEXPR, 1, a[0]->cell);
+}
+
+Value* builtin_tail(Env* e, int n, Value** a) {
+  if (a[0]->type == TL_SEQ) return tl_builtin_uncons(e, a[0], "tail", 1);
+  TL_ASSERT(a[0]->count != 0, "Function 'tail' passed empty list");
+  return tl_builtin_list(TL_QEXPR, a[0]->count-1, a[0]->cell+1);
+}
+
+Value* builtin_eval(Env* e, int n, Value** a) {
+  return tl_val_eval(e, tl_builtin_list(TL_SEXPR, a[0]->count, a[0]->cell));
+}
+
+Value* builtin_join(Env* e, int n, Value** a) {
+  Value* x = tl_val_qexpr();
+  for (int i=0; i < n; i++) x->count += a[i]->count;
+  x->cell = malloc(sizeof(Value*) * x->count);
+
+  int k = 0;
+  for (int i=0; i < n; i++) {
+    for (int j=0; j < a[i]->count; j++) x->cell[k++] = tl_val_copy(a[i]->cell[j]);
+  }
+  return x;
+}
 
-  Value* x = tl_val_pop(a, 0);
+/* Applies 'fn' to borrowed arguments. A builtin goes straight to its
+ * kernel; anything else is run by the machine. */
+Value* tl_builtin_apply(Env* e, Value* fn, int n, Value** a) {
+  if (fn->builtin) return tl_builtin_call(e, fn->builtin, n, a);
+  return tl_val_call(e, fn, n, a);
+}
+
+// Frees the first 'n' values of a result being built, and the result
+static Value* tl_builtin_abandon(Value* x, int n, Value* err) {
+  for (int i=0; i < n; i++) tl_val_delete(x->cell[i]);
+  x->count = 0;
+  tl_val_delete(x);
+  return err;
+}
 
-  if(strcmp(op, "-") && a->count == 0)
-    x->num = -x->num;
+/* The sequence builtins walk the input's cells in place and pass each
+ * element to the function borrowed, through one argument buffer. */
+Value* builtin_map(Env* e, int n, Value** a) {
+  if (a[1]->type == TL_SEQ) {
+    a[1]->seq->refs++;
+    return tl_seq_new(tl_seq_map(TL_SEQ_MAP, a[0], a[1]->seq));
+  }
 
-  while (a->count > 0) {
-    Value* y = tl_val_pop(a, 0);
+  Value* xs = a[1];
+  Value* x = tl_val_qexpr();
+  if (xs->count == 0) return x;
 
-    if(strcmp(op, "+") == 0) x->num += y->num;
-    if(strcmp(op, "-") == 0) x->num -= y->num;
-    if(strcmp(op, "*") == 0) x->num *= y->num;
+  x->cell = malloc(sizeof(Value*) * xs->count);
+  x->count = xs->count;
+  for (int i=0; i < xs->count; i++) {
+    Value* y = tl_builtin_apply(e, a[0], 1, &xs->cell[i]);
+    if (y->type == TL_ERROR) return tl_builtin_abandon(x, i, y);
+    x->cell[i] = y;
+  }
+  return x;
+}
 
-    if(strcmp(op, "/") == 0) {
-      if (y->num == 0) {
-        tl_val_delete(x);
+Value* builtin_filter(Env* e, int n, Value** a) {
+  if (a[1]->type == TL_SEQ) {
+    a[1]->seq->refs++;
+    return tl_seq_new(tl_seq_map(TL_SEQ_FILTER, a[0], a[1]->seq));
+  }
+
+  Value* xs = a[1];
+  Value* x = tl_val_qexpr();
+  if (xs->count == 0) return x;
+
+  x->cell = malloc(sizeof(Value*) * xs->count);
+  x->count = xs->count;
+  int k = 0;
+  for (int i=0; i < xs->count; i++) {
+    Value* y = tl_builtin_apply(e, a[0], 1, &xs->cell[i]);
+    if (y->type != TL_INTEGER) {
+      if (y->type != TL_ERROR) {
+        Value* err = tl_val_error(
+            "Function 'filter' predicate returned incorrect type. Got %s, expected %s",
+            tl_type_name(y->type), tl_type_name(TL_INTEGER));
         tl_val_delete(y);
-        x = tl_val_error("Divide by zero");
-        break;
+        y = err;
       }
-      x->num /= y->num;
+      return tl_builtin_abandon(x, k, y);
     }
+    if (y->num) x->cell[k++] = tl_val_copy(xs->cell[i]);
+    tl_val_delete(y);
   }
 
-  tl_val_delete(a);
+  x->count = k;
+  if (k == 0) {
+    free(x->cell);
+    x->cell = NULL;
+  }
   return x;
 }
 
-Value* builtin_list(Env* e, Value* v) {
-  v->type = TL_QEXPR;
-  return v;
+/* Folds the cells of 'xs' from 'from' towards 'to' into 'acc', which it
+ * takes ownership of. 'left' passes the accumulator first. */
+static Value* tl_builtin_fold(Env* e, Value* fn, Value* acc, Value* xs,
+    int from, int to, int left) {
+  int step = from <= to ? 1 : -1;
+  Value* args[2];
+  for (int i=from; i != to; i += step) {
+    args[left ? 0 : 1] = acc;
+    args[left ? 1 : 0] = xs->cell[i];
+    Value* y = tl_builtin_apply(e, fn, 2, args);
+    tl_val_delete(acc);
+    if (y->type == TL_ERROR) return y;
+    acc = y;
+  }
+  return acc;
+}
+
+/* Collects up to 'max' elements of sequence 'v' into a Q-expression, or
+ * all of them when 'max' is negative. The walk does not force 'v'. */
+static Value* tl_builtin_collect(Env* e, Value* v, long max) {
+  Value* x = tl_val_qexpr();
+  Seq* s = v->seq;
+  s->refs++;
+
+  int size = 0;
+  while (max < 0 || x->count < max) {
+    Value* y;
+    Value* err = tl_seq_next(&s, e, &y);
+    if (err) {
+      tl_seq_release(s);
+      tl_val_delete(x);
+      return err;
+    }
+    if (!y) break;
+
+    if (x->count == size) {
+      size = size ? size * 2 : 16;
+      x->cell = realloc(x->cell, sizeof(Value*) * size);
+    }
+    x->cell[x->count++] = y;
+  }
+  tl_seq_release(s);
+  return x;
+}
+
+// Folds sequence 'v' from the left, one element at a time
+static Value* tl_builtin_fold_seq(Env* e, Value* fn, Value* acc, Value* v) {
+  Seq* s = v->seq;
+  s->refs++;
+
+  Value* args[2];
+  while (1) {
+    Value* y;
+    Value* err = tl_seq_next(&s, e, &y);
+    if (err || !y) {
+      tl_seq_release(s);
+      if (err) tl_val_delete(acc);
+      return err ? err : acc;
+    }
+
+    args[0] = acc;
+    args[1] = y;
+    Value* r = tl_builtin_apply(e, fn, 2, args);
+    tl_val_delete(acc);
+    tl_val_delete(y);
+    if (r->type == TL_ERROR) {
+      tl_seq_release(s);
+      return r;
+    }
+    acc = r;
+  }
+}
+
+Value* builtin_foldl(Env* e, int n, Value** a) {
+  if (a[2]->type == TL_SEQ) return tl_builtin_fold_seq(e, a[0], tl_val_copy(a[1]), a[2]);
+  return tl_builtin_fold(e, a[0], tl_val_copy(a[1]), a[2], 0, a[2]->count, 1);
+}
+
+Value* builtin_foldr(Env* e, int n, Value** a) {
+  if (a[2]->type == TL_SEQ) {
+    // Folding from the right needs every element, so the sequence must end
+    Value* xs = tl_builtin_collect(e, a[2], -1);
+    if (xs->type == TL_ERROR) return xs;
+    Value* x = tl_builtin_fold(e, a[0], tl_val_copy(a[1]), xs, xs->count-1, -1, 0);
+    tl_val_delete(xs);
+    return x;
+  }
+  return tl_builtin_fold(e, a[0], tl_val_copy(a[1]), a[2], a[2]->count-1, -1, 0);
 }
 
-Value* builtin_head(Env* e, Value* v) {
-  TL_ASSERT(v, (v->count == 1),
-      "Function 'head' passed too many arguments. Got %i, Expected %i",
-      v->count, 1);
+Value* builtin_reduce(Env* e, int n, Value** a) {
+  if (a[1]->type == TL_SEQ) {
+    Seq* s = a[1]->seq;
+    s->refs++;
+    Value* x;
+    Value* err = tl_seq_next(&s, e, &x);
+    if (!err && !x) err = tl_val_error("Function 'reduce' passed empty list");
+    if (err) {
+      tl_seq_release(s);
+      return err;
+    }
+
+    Value* rest = tl_seq_new(s);
+    x = tl_builtin_fold_seq(e, a[0], x, rest);
+    tl_val_delete(rest);
+    return x;
+  }
 
-  TL_ASSERT(v, (v->cell[0]->type == TL_QEXPR),
-      "Function 'head' passed invalid types.");
+  TL_ASSERT(a[1]->count != 0, "Function 'reduce' passed empty list");
+  return tl_builtin_fold(e, a[0], tl_val_copy(a[1]->cell[0]), a[1], 1, a[1]->count, 1);
+}
 
-  TL_ASSERT(v, (v->cell[0]->count != 0),
-      "Function 'head' passed empty list");
+Value* builtin_take(Env* e, int n, Value** a) {
+  long max = a[0]->num < 0 ? 0 : a[0]->num;
+  if (a[1]->type == TL_SEQ) return tl_builtin_collect(e, a[1], max);
+  return tl_builtin_list(TL_QEXPR, max < a[1]->count ? max : a[1]->count, a[1]->cell);
+}
 
-  Value* x = tl_val_take(v, 0);
-  while(x->count > 1) tl_val_delete(tl_val_pop(x, 1));
+/* (range end), (range start end) or (range start end step) counts from
+ * 'start', 0 by default, up to but not including 'end'. */
+Value* builtin_range(Env* e, int n, Value** a) {
+  long from = n == 1 ? 0 : a[0]->num;
+  long to = n == 1 ? a[0]->num : a[1]->num;
+  long step = n == 3 ? a[2]->num : 1;
+  TL_ASSERT(step != 0, "Function 'range' passed a step of 0");
+  return tl_seq_new(tl_seq_range(from, to, step));
+}
+
+Value* builtin_iterate(Env* e, int n, Value** a) {
+  return tl_seq_new(tl_seq_iterate(a[0], a[1]));
+}
+
+Value* builtin_repeat(Env* e, int n, Value** a) {
+  TL_ASSERT(n == 1 || a[1]->num >= 0, "Function 'repeat' passed a negative count");
+  return tl_seq_new(tl_seq_repeat(a[0], n == 2 ? a[1]->num : -1));
+}
+
+/* (memo f) or (memo f capacity) wraps 'f' so that a call with arguments
+ * it has seen before returns the earlier result, keeping at most
+ * 'capacity' results when it is given. */
+Value* builtin_memo(Env* e, int n, Value** a) {
+  TL_ASSERT(n == 1 || a[1]->num > 0, "Function 'memo' passed a capacity below 1");
+  if (a[0]->memo) return tl_val_copy(a[0]);
+  return tl_memo_new(a[0], n == 2 ? a[1]->num : 0);
+}
+
+// {hits misses size} of a memoised function
+Value* builtin_memo_stats(Env* e, int n, Value** a) {
+  TL_ASSERT(a[0]->memo, "Function 'memo-stats' passed a function that is not memoised");
+  Memo* m = a[0]->memo;
+  Value* x = tl_val_qexpr();
+  tl_val_add(x, tl_val_num(m->hits));
+  tl_val_add(x, tl_val_num(m->misses));
+  tl_val_add(x, tl_val_num(m->count));
   return x;
 }
 
-Value* builtin_tail(Env* e, Value* v) {
-  TL_ASSERT(v, (v->count == 1), "Function 'tail' passed too many arguments");
-  TL_ASSERT(v, (v->cell[0]->type == TL_QEXPR), "Function 'tail' passed invalid type");
-  TL_ASSERT(v, (v->cell[0]->count != 0), "Function 'tail' passed empty list");
+/* The hash-consed form of an expression, which compares and copies in
+ * constant time. It is not pure, so that the optimizer never puts shared
+ * nodes into code it rewrites. */
+Value* builtin_intern(Env* e, int n, Value** a) {
+  return tl_intern(a[0]);
+}
+
+/* (specialize f a b ...) is 'f' with its first arguments fixed, like a
+ * partial application, but with its body folded for them ahead of time. */
+Value* builtin_specialize(Env* e, int n, Value** a) {
+  TL_ASSERT(!a[0]->builtin && !a[0]->memo, "Function 'specialize' passed a function that is not a lambda");
+  TL_ASSERT(n - 1 <= tl_val_arity(a[0]),
+      "Function 'specialize' passed too many arguments. Got %i, expected at most %i",
+      n - 1, tl_val_arity(a[0]));
+  return tl_opt_specialize(e, a[0], n - 1, a + 1);
+}
+
+static Value* tl_builtin_define(Env* e, Value* name, Value* formals, Value* body) {
+  Value* fn = tl_val_sexpr();
+  tl_val_add(fn, tl_val_symbol("\\"));
+  tl_val_add(fn, formals);
+  tl_val_add(fn, body);
+
+  Value* def = tl_val_sexpr();
+  tl_val_add(def, tl_val_symbol("def"));
+  tl_val_add(def, tl_val_add(tl_val_qexpr(), tl_val_copy(name)));
+  tl_val_add(def, fn);
 
-  Value* x = tl_val_take(v, 0);
-  tl_val_delete(tl_val_pop(x, 0));
+  Value* x = tl_val_eval(e, tl_opt_fold(e, def));
+  if (x->type == TL_ERROR) return x;
+  tl_val_delete(x);
+  return NULL;
+}
+
+static Value* tl_builtin_code(char* fn, Value* a, Value* b, Value* c, Value* d) {
+  Value* x = tl_val_add(tl_val_qexpr(), tl_val_symbol(fn));
+  Value* args[] = { a, b, c, d };
+  for (int i=0; i < 4 && args[i]; i++) tl_val_add(x, args[i]);
   return x;
 }
 
-Value* builtin_eval(Env* e, Value* v) {
-  TL_ASSERT(v, (v->count == 1), "Function 'eval' passed too many arguments");
-  TL_ASSERT(v, (v->cell[0]->type == TL_QEXPR), "Function 'eval' passed invalid types");
+/* (defrecord {point} {x y}) defines record type 'point' with fields 'x'
+ * and 'y'. The functions it defines are lambdas over the type with the
+ * offset of each field in place of its name, defined as 'def' would, so
+ * that a call to one can be inlined into a call to a pure builtin. */
+Value* builtin_defrecord(Env* e, int n, Value** a) {
+  TL_ASSERT(a[0]->count == 1 && a[0]->cell[0]->type == TL_SYMBOL,
+    "Function 'defrecord' passed an invalid name. Expected a single symbol");
+  for (int i=0; i < a[1]->count; i++) {
+    Value* f = a[1]->cell[i];
+    TL_ASSERT(f->type == TL_SYMBOL && strcmp(f->sym, "&") != 0,
+      "Function 'defrecord' passed an invalid field. Expected a symbol");
+    for (int j=0; j < i; j++) {
+      TL_ASSERT(strcmp(a[1]->cell[j]->sym, f->sym) != 0,
+        "Function 'defrecord' passed field '%s' twice", f->sym);
+    }
+  }
+
+  // Formals end in '#', which no program can spell, so they shadow nothing
+  Value* type = tl_record_type(a[0]->cell[0]->sym, a[1]);
+  Value* names = tl_record_names(a[0]->cell[0], a[1]);
+  Value* err = NULL;
+  for (int i=0; i < names->count && !err; i++) {
+    Value* formals = tl_val_qexpr();
+    Value* body;
+    int k = (i - 2) / 2;
+
+    if (i == 0) {
+      body = tl_builtin_code("record", tl_val_copy(type), NULL, NULL, NULL);
+      for (int j=0; j < a[1]->count; j++) {
+        Value* f = tl_val_copy(a[1]->cell[j]);
+        f->sym = realloc(f->sym, strlen(f->sym) + 2);
+        strcat(f->sym, "#");
+        tl_val_add(body, tl_val_copy(f));
+        tl_val_add(formals, f);
+      }
+    } else if (i == 1) {
+      tl_val_add(formals, tl_val_symbol("r#"));
+      body = tl_builtin_code("is-record", tl_val_symbol("r#"), tl_val_copy(type), NULL, NULL);
+    } else if (i % 2 == 0) {
+      tl_val_add(formals, tl_val_symbol("r#"));
+      body = tl_builtin_code("record-get", tl_val_symbol("r#"), tl_val_copy(type),
+        tl_val_num(k), NULL);
+    } else {
+      tl_val_add(formals, tl_val_symbol("r#"));
+      tl_val_add(formals, tl_val_symbol("v#"));
+      body = tl_builtin_code("record-with", tl_val_symbol("r#"), tl_val_copy(type),
+        tl_val_num(k), tl_val_symbol("v#"));
+    }
+    err = tl_builtin_define(e, names->cell[i], formals, body);
+  }
+
+  tl_val_delete(names);
+  tl_val_delete(type);
+  return err ? err : tl_val_sexpr();
+}
+
+static char* tl_builtin_kind(Value* v) {
+  return v->type == TL_RECORD && v->record->type ? v->record->type->name : tl_type_name(v->type);
+}
+
+// Record type 't' and the offset 'i' of one of its fields, if any
+static Value* tl_builtin_field(char* fn, Value* t, Value* i) {
+  TL_ASSERT(t->type == TL_RECORD && !t->record->type,
+    "Function '%s' passed incorrect type for its record type. Got %s",
+    fn, tl_builtin_kind(t));
+  TL_ASSERT(!i || (i->num >= 0 && i->num < t->record->count),
+    "Function '%s' passed field offset %li out of range", fn, i->num);
+  return NULL;
+}
+
+// (record type x y ...) is a record of 'type' with the fields 'x y ...'
+Value* builtin_record(Env* e, int n, Value** a) {
+  Value* err = tl_builtin_field("record", a[0], NULL);
+  if (err) return err;
+  Record* t = a[0]->record;
+  TL_ASSERT(n - 1 == t->count,
+    "Function '%s' passed incorrect number of arguments. Got: %i, expected: %i",
+    t->name, n - 1, t->count);
+  return tl_record_new(t, a + 1);
+}
+
+Value* builtin_record_get(Env* e, int n, Value** a) {
+  Value* err = tl_builtin_field("record-get", a[1], a[2]);
+  if (err) return err;
+  Record* t = a[1]->record;
+  TL_ASSERT(a[0]->type == TL_RECORD && a[0]->record->type == t,
+    "Function '%s-%s' passed incorrect type for argument 0. Got %s, Expected %s",
+    t->name, t->names[a[2]->num], tl_builtin_kind(a[0]), t->name);
+  return tl_val_copy(a[0]->record->fields[a[2]->num]);
+}
+
+Value* builtin_record_with(Env* e, int n, Value** a) {
+  Value* err = tl_builtin_field("record-with", a[1], a[2]);
+  if (err) return err;
+  Record* t = a[1]->record;
+  TL_ASSERT(a[0]->type == TL_RECORD && a[0]->record->type == t,
+    "Function '%s-with-%s' passed incorrect type for argument 0. Got %s, Expected %s",
+    t->name, t->names[a[2]->num], tl_builtin_kind(a[0]), t->name);
+  return tl_record_with(a[0]->record, a[2]->num, a[3]);
+}
+
+Value* builtin_record_is(Env* e, int n, Value** a) {
+  Value* err = tl_builtin_field("is-record", a[1], NULL);
+  if (err) return err;
+  return tl_val_num(a[0]->type == TL_RECORD && a[0]->record->type == a[1]->record);
+}
+
+// (defcell {name} {expr}) defines a reactive cell
+Value* builtin_defcell(Env* e, int n, Value** a) {
+  TL_ASSERT(a[0]->count == 1 && a[0]->cell[0]->type == TL_SYMBOL,
+    "Function 'defcell' passed an invalid name. Expected a single symbol");
+  return tl_cell_define(e, a[0]->cell[0], a[1]);
+}
+
+Value* builtin_batch(Env* e, int n, Value** a) {
+  return tl_cell_batch(e, a[0]);
+}
+
+/* Takes the names of the cells to report on, or {} for all of them, as
+ * a call with no arguments would not be made. */
+Value* builtin_cell_stats(Env* e, int n, Value** a) {
+  return tl_cell_stats(a[0]);
+}
+
+/* A transducer is a Q-expression of stages, each {name argument}, so
+ * 'join' composes them. A pass pushes one element at a time from the
+ * source through every stage and into the sink, so no list is built
+ * between stages and 'take' can stop the source early. */
+enum { TL_STAGE_MAP, TL_STAGE_FILTER, TL_STAGE_TAKE, TL_STAGE_DROP,
+       TL_STAGE_TAKE_WHILE, TL_STAGE_DROP_WHILE };
+
+static char* tl_stage_names[] = {
+  "map", "filter", "take", "drop", "take-while", "drop-while", NULL
+};
+
+typedef struct {
+  Env* env;
+  int count;
+  int* kinds;
+  Value** args;
+  long* seen;
+  Value* fn;
+  Value* acc;
+  int size;
+  int done;
+} tl_pass;
+
+static Value* tl_builtin_stage(int kind, Value* arg) {
+  Value* s = tl_val_add(tl_val_qexpr(), tl_val_symbol(tl_stage_names[kind]));
+  tl_val_add(s, tl_val_copy(arg));
+  return tl_val_add(tl_val_qexpr(), s);
+}
+
+Value* builtin_xmap(Env* e, int n, Value** a)        { return tl_builtin_stage(TL_STAGE_MAP, a[0]); }
+Value* builtin_xfilter(Env* e, int n, Value** a)     { return tl_builtin_stage(TL_STAGE_FILTER, a[0]); }
+Value* builtin_xtake(Env* e, int n, Value** a)       { return tl_builtin_stage(TL_STAGE_TAKE, a[0]); }
+Value* builtin_xdrop(Env* e, int n, Value** a)       { return tl_builtin_stage(TL_STAGE_DROP, a[0]); }
+Value* builtin_xtake_while(Env* e, int n, Value** a) { return tl_builtin_stage(TL_STAGE_TAKE_WHILE, a[0]); }
+Value* builtin_xdrop_while(Env* e, int n, Value** a) { return tl_builtin_stage(TL_STAGE_DROP_WHILE, a[0]); }
 
-  Value* x = tl_val_take(v, 0);
-  x->type = TL_SEXPR;
-  return tl_val_eval(e, x);
+// Decodes the stages of 'xf' up front so a pass does no name lookups
+static Value* tl_pass_init(tl_pass* p, Env* e, Value* xf) {
+  p->env = e;
+  p->count = xf->count;
+  p->kinds = malloc(sizeof(int) * xf->count);
+  p->args = malloc(sizeof(Value*) * xf->count);
+  p->seen = calloc(xf->count, sizeof(long));
+  p->fn = NULL;
+  p->acc = NULL;
+  p->size = 0;
+  p->done = 0;
+
+  for (int i=0; i < xf->count; i++) {
+    Value* s = xf->cell[i];
+    p->kinds[i] = -1;
+    if (s->type == TL_QEXPR && s->count == 2 && s->cell[0]->type == TL_SYMBOL) {
+      for (int k=0; tl_stage_names[k]; k++) {
+        if (strcmp(s->cell[0]->sym, tl_stage_names[k]) == 0) p->kinds[i] = k;
+      }
+    }
+    if (p->kinds[i] < 0) return tl_val_error("Transducer stage %i is not valid", i);
+
+    p->args[i] = s->cell[1];
+    int counted = p->kinds[i] == TL_STAGE_TAKE || p->kinds[i] == TL_STAGE_DROP;
+    int type = counted ? TL_INTEGER : TL_FUNCTION;
+    if (p->args[i]->type != type) {
+      return tl_val_error("Transducer stage '%s' passed incorrect type. Got %s, expected %s",
+          tl_stage_names[p->kinds[i]], tl_type_name(p->args[i]->type), tl_type_name(type));
+    }
+  }
+  if (p->count && p->kinds[0] == TL_STAGE_TAKE && p->args[0]->num <= 0) p->done = 1;
+  return NULL;
+}
+
+static void tl_pass_free(tl_pass* p) {
+  free(p->kinds);
+  free(p->args);
+  free(p->seen);
 }
 
-Value* builtin_join(Env* e, Value* v) {
-  for(int i=0; i < v->count; i++) {
-    TL_ASSERT(v, (v->cell[0]->type == TL_QEXPR), "Function 'join' passed invalid type");
+// Asks predicate 'f' about 'x'. Sets 'err' instead if it does not answer.
+static int tl_pass_test(tl_pass* p, Value* f, Value* x, Value** err) {
+  Value* y = tl_builtin_apply(p->env, f, 1, &x);
+  if (y->type != TL_INTEGER) {
+    *err = y->type == TL_ERROR ? y : tl_val_error(
+        "Transducer predicate returned incorrect type. Got %s, expected %s",
+        tl_type_name(y->type), tl_type_name(TL_INTEGER));
+    if (*err != y) tl_val_delete(y);
+    return 0;
   }
+  int r = y->num != 0;
+  tl_val_delete(y);
+  return r;
+}
 
-  Value* x = tl_val_pop(v, 0);
-  while(v->count > 0) x = tl_val_join(x, tl_val_pop(v, 0));
-  tl_val_delete(v);
-  return x;
+/* Runs borrowed element 'x' through the stages into the sink. Returns an
+ * error, or NULL once it has been delivered or dropped. */
+static Value* tl_pass_step(tl_pass* p, Value* x) {
+  Value* owned = NULL;
+  Value* err = NULL;
+
+  for (int i=0; i < p->count; i++) {
+    Value* arg = p->args[i];
+    switch (p->kinds[i]) {
+      case TL_STAGE_MAP: {
+        Value* y = tl_builtin_apply(p->env, arg, 1, &x);
+        if (owned) tl_val_delete(owned);
+        if (y->type == TL_ERROR) return y;
+        owned = x = y;
+        break;
+      }
+
+      case TL_STAGE_FILTER:
+        if (!tl_pass_test(p, arg, x, &err)) goto drop;
+        break;
+
+      case TL_STAGE_TAKE:
+        // The source is stopped as soon as the last element is through
+        if (p->seen[i] >= arg->num) {
+          p->done = 1;
+          goto drop;
+        }
+        if (++p->seen[i] >= arg->num) p->done = 1;
+        break;
+
+      case TL_STAGE_DROP:
+        if (p->seen[i] < arg->num) {
+          p->seen[i]++;
+          goto drop;
+        }
+        break;
+
+      case TL_STAGE_TAKE_WHILE:
+        if (!tl_pass_test(p, arg, x, &err)) {
+          p->done = 1;
+          goto drop;
+        }
+        break;
+
+      case TL_STAGE_DROP_WHILE:
+        if (!p->seen[i]) {
+          if (tl_pass_test(p, arg, x, &err)) goto drop;
+          if (err) goto drop;
+          p->seen[i] = 1;
+        }
+        break;
+    }
+  }
+
+  if (p->fn) {
+    Value* args[2] = { p->acc, x };
+    Value* y = tl_builtin_apply(p->env, p->fn, 2, args);
+    tl_val_delete(p->acc);
+    p->acc = NULL;
+    if (owned) tl_val_delete(owned);
+    if (y->type == TL_ERROR) return y;
+    p->acc = y;
+    return NULL;
+  }
+
+  // Collecting into a list, whose cells grow by doubling
+  if (p->acc->count == p->size) {
+    p->size = p->size ? p->size * 2 : 16;
+    p->acc->cell = realloc(p->acc->cell, sizeof(Value*) * p->size);
+  }
+  p->acc->cell[p->acc->count++] = owned ? owned : tl_val_copy(x);
+  return NULL;
+
+drop:
+  if (owned) tl_val_delete(owned);
+  return err;
 }
 
-Value* builtin_lambda(Env* e, Value* v) {
-  TL_ASSERT_NUM("\\", v, 2);
-  TL_ASSERT_TYPE("\\", v, 0, TL_QEXPR);
-  TL_ASSERT_TYPE("\\", v, 1, TL_QEXPR);
+// Feeds every element of 'source': a Q-expression, sequence or generator
+static Value* tl_pass_run(tl_pass* p, Value* source) {
+  if (source->type == TL_QEXPR) {
+    for (int i=0; i < source->count && !p->done; i++) {
+      Value* err = tl_pass_step(p, source->cell[i]);
+      if (err) return err;
+    }
+    return NULL;
+  }
+
+  if (source->type == TL_SEQ) {
+    Seq* s = source->seq;
+    s->refs++;
+    Value* err = NULL;
+    while (!p->done && !err) {
+      Value* x;
+      err = tl_seq_next(&s, p->env, &x);
+      if (err || !x) break;
+      err = tl_pass_step(p, x);
+      tl_val_delete(x);
+    }
+    tl_seq_release(s);
+    return err;
+  }
+
+  if (source->type == TL_GENERATOR) {
+    while (!p->done) {
+      Value* y = tl_machine_resume(source->machine, p->env);
+      if (y->type == TL_ERROR) return y;
+      if (y->count == 0) {
+        tl_val_delete(y);
+        break;
+      }
+      Value* err = tl_pass_step(p, y->cell[0]);
+      tl_val_delete(y);
+      if (err) return err;
+    }
+    return NULL;
+  }
+
+  return tl_val_error("Transducer source has incorrect type. Got %s, expected %s, %s or %s",
+      tl_type_name(source->type), tl_type_name(TL_QEXPR), tl_type_name(TL_SEQ),
+      tl_type_name(TL_GENERATOR));
+}
 
-  for(int i=0; i < v->cell[0]->count; i++) {
-    TL_ASSERT(v, (v->cell[0]->cell[i]->type == TL_SYMBOL), "Lambda params must be symbols");
+static Value* tl_pass_finish(tl_pass* p, Value* err) {
+  tl_pass_free(p);
+  if (err) {
+    if (p->acc) tl_val_delete(p->acc);
+    return err;
   }
+  return p->acc;
+}
 
-  Value* formals = tl_val_pop(v, 0);
-  Value* body = tl_val_pop(v, 0);
-  tl_val_delete(v);
+Value* builtin_transduce(Env* e, int n, Value** a) {
+  tl_pass p;
+  Value* err = tl_pass_init(&p, e, a[0]);
+  p.fn = a[1];
+  p.acc = tl_val_copy(a[2]);
+  return tl_pass_finish(&p, err ? err : tl_pass_run(&p, a[3]));
+}
 
-  return tl_val_lambda(formals, body);
+Value* builtin_into(Env* e, int n, Value** a) {
+  tl_pass p;
+  Value* err = tl_pass_init(&p, e, a[0]);
+  p.acc = tl_val_qexpr();
+  err = err ? err : tl_pass_run(&p, a[1]);
+  if (!err && p.acc->count < p.size) {
+    p.acc->cell = realloc(p.acc->cell, sizeof(Value*) * p.acc->count);
+  }
+  return tl_pass_finish(&p, err);
 }
 
-Value* builtin_var(Env* e, Value* v, char* fn) {
-  TL_ASSERT_TYPE(fn, v, 0, TL_QEXPR);
+Value* builtin_lambda(Env* e, int n, Value** a) {
+  for(int i=0; i < a[0]->count; i++) {
+    TL_ASSERT((a[0]->cell[i]->type == TL_SYMBOL), "Lambda params must be symbols");
+  }
 
-  Value* syms = v->cell[0];
+  return tl_val_lambda(tl_val_copy(a[0]), tl_opt_body(e, tl_val_copy(a[1]), a[0]));
+}
+
+/* Binds the symbols in a[0] to the values that follow. With 'move' set
+ * the values are taken out of 'a' rather than copied. */
+Value* builtin_var(Env* e, int n, Value** a, char* fn, int move) {
+  Value* syms = a[0];
   for(int i=0; i < syms->count; i++) {
-    TL_ASSERT(v, (syms->cell[i]->type == TL_SYMBOL),
+    TL_ASSERT((syms->cell[i]->type == TL_SYMBOL),
         "Function '%s' cannot define non-symbol. Got: %s, expected %s.",
         fn, tl_type_name(syms->cell[i]->type), tl_type_name(TL_SYMBOL));
   }
 
-  TL_ASSERT(v, (syms->count == v->count-1),
+  TL_ASSERT((syms->count == n-1),
       "Function '%s' passed too many arguments for symbols. Got: %i, expected: %i",
-      fn, syms->count, v->count-1);
+      fn, syms->count, n-1);
+
+  if (strcmp(fn, "def") == 0) {
+    while (e->parent) e = e->parent;
+  }
 
   for(int i=0; i < syms->count; i++) {
-    if (strcmp(fn, "def") == 0) tl_env_def(e, syms->cell[i], v->cell[i+1]);
-    if (strcmp(fn, "=")   == 0) tl_env_put(e, syms->cell[i], v->cell[i+1]);
+    tl_env_set(e, syms->cell[i], move ? a[i+1] : tl_val_copy(a[i+1]));
+    if (move) a[i+1] = NULL;
   }
 
-  tl_val_delete(v);
+  tl_cell_changed(e, syms);
   return tl_val_sexpr();
 }
 
-Value* builtin_def(Env* e, Value* v) { return builtin_var(e, v, "def"); }
-Value* builtin_put(Env* e, Value* v) { return builtin_var(e, v, "="); }
-
-Value* builtin_add      (Env* e, Value* v) { return builtin_op(e, v, "+"); }
-Value* builtin_subtract (Env* e, Value* v) { return builtin_op(e, v, "-"); }
-Value* builtin_multiply (Env* e, Value* v) { return builtin_op(e, v, "*"); }
-Value* builtin_divide   (Env* e, Value* v) { return builtin_op(e, v, "/"); }
+Value* builtin_def(Env* e, int n, Value** a) { return builtin_var(e, n, a, "def", 0); }
+Value* builtin_put(Env* e, int n, Value** a) { return builtin_var(e, n, a, "=", 0); }
 
-Value* builtin_ord(Env* e, Value* a, char* op) {
-  TL_ASSERT_NUM(op, a, 2);
-  TL_ASSERT_TYPE(op, a, 0, TL_INTEGER);
-  TL_ASSERT_TYPE(op, a, 1, TL_INTEGER);
+// (defmacro {name} {formals} {body}) defines a macro globally
+Value* builtin_defmacro(Env* e, int n, Value** a) {
+  TL_ASSERT(a[0]->count == 1 && a[0]->cell[0]->type == TL_SYMBOL,
+      "Function 'defmacro' passed incorrect name. Expected a single symbol");
 
-  int r;
+  Value* x = builtin_lambda(e, 2, a + 1);
+  if (x->type == TL_ERROR) return x;
+  x->macro = 1;
+  tl_env_def(e, a[0]->cell[0], x);
+  tl_val_delete(x);
+  return tl_val_sexpr();
+}
 
-  if (strcmp(op, ">") == 0) {
-    r = (a->cell[0]->num > a->cell[1]->num);
-  }
-  if (strcmp(op, ">=") == 0) {
-    r = (a->cell[0]->num >= a->cell[1]->num);
-  }
-  if (strcmp(op, "<") == 0) {
-    r = (a->cell[0]->num < a->cell[1]->num);
-  }
-  if (strcmp(op, "<=") == 0) {
-    r = (a->cell[0]->num <= a->cell[1]->num);
-  }
-  tl_val_delete(a);
-  return tl_val_num(r);
+Value* builtin_quote(Env* e, int n, Value** a) {
+  return tl_val_copy(a[0]);
 }
 
 int tl_val_eq(Value* x, Value* y) {
@@ -169,14 +934,36 @@ int tl_val_eq(Value* x, Value* y) {
 
     case TL_FUNCTION:
       if (x->builtin || y->builtin) {
-        return x->builtin == y->builtin;
+        return x->builtin == y->builtin && x->num == y->num;
+      } else if (x->memo || y->memo) {
+        return x->memo == y->memo;
+      } else if (x->partial || y->partial) {
+        if (!x->partial || !y->partial) return 0;
+        if (x->partial == y->partial) return 1;
+        if (x->partial->count != y->partial->count) return 0;
+        for (int i=0; i < x->partial->count; i++) {
+          if (!tl_val_eq(x->partial->args[i], y->partial->args[i])) return 0;
+        }
+        return tl_val_eq(x->partial->fn, y->partial->fn);
       } else {
-        return tl_val_eq(x->formals, y->formals) 
+        return x->macro == y->macro && tl_val_eq(x->formals, y->formals)
           && tl_val_eq(x->body, y->body);
       }
 
+    case TL_GENERATOR: return x->machine == y->machine;
+    case TL_SEQ:       return x->seq == y->seq;
+
+    case TL_RECORD:
+      if (x->record == y->record) return 1;
+      if (!x->record->type || x->record->type != y->record->type) return 0;
+      for (int i = 0; i < x->record->count; i++) {
+        if (!tl_val_eq(x->record->fields[i], y->record->fields[i])) return 0;
+      }
+      return 1;
+
     case TL_QEXPR:
     case TL_SEXPR:
+      if (x->intern && y->intern) return x->intern == y->intern;
       if (x->count != y->count) { return 0; }
       for (int i = 0; i < x->count; i++) {
         if (!tl_val_eq(x->cell[i], y->cell[i])) { return 0; }
@@ -187,44 +974,204 @@ int tl_val_eq(Value* x, Value* y) {
   return 0;
 }
 
-Value* builtin_cmp(Env* e, Value* a, char* op) {
-  TL_ASSERT_NUM(op, a, 2);
+/* A hash consistent with 'tl_val_eq': values it finds equal hash alike.
+ * Functions all hash alike, as they are rarely used as keys. */
+unsigned long tl_val_hash(Value* v) {
+  unsigned long h = v->type + 1;
+  char* s = NULL;
+
+  switch (v->type) {
+    case TL_INTEGER:   return h * 0x9e3779b97f4a7c15UL ^ (unsigned long)v->num;
+    case TL_ERROR:     s = v->err; break;
+    case TL_SYMBOL:    s = v->sym; break;
+    case TL_STRING:    s = v->str; break;
+    case TL_GENERATOR: return h ^ (unsigned long)v->machine;
+    case TL_SEQ:       return h ^ (unsigned long)v->seq;
+
+    case TL_RECORD:
+      if (!v->record->type) return h ^ (unsigned long)v->record;
+      h ^= (unsigned long)v->record->type;
+      for (int i = 0; i < v->record->count; i++) h = h * 31 + tl_val_hash(v->record->fields[i]);
+      return h;
+
+    case TL_QEXPR:
+    case TL_SEXPR:
+      if (v->intern) return v->intern->hash;
+      for (int i = 0; i < v->count; i++) h = h * 31 + tl_val_hash(v->cell[i]);
+      return h;
+  }
+
+  while (s && *s) h = h * 31 + (unsigned char)*s++;
+  return h;
+}
+
+Value* builtin_eq(Env* e, int n, Value** a) { return tl_val_num(tl_val_eq(a[0], a[1])); }
+Value* builtin_ne(Env* e, int n, Value** a) { return tl_val_num(!tl_val_eq(a[0], a[1])); }
+
+Value* builtin_if(Env* e, int n, Value** a) {
+  Value* x = a[0]->num ? a[1] : a[2];
+  return tl_val_eval(e, tl_builtin_list(TL_SEXPR, x->count, x->cell));
+}
+
+/* 'match' is a special form that sees its patterns as written. Called
+ * any other way, the patterns have been evaluated, which leaves literals
+ * and lists of them matching as before. */
+Value* builtin_match(Env* e, int n, Value** a) {
+  Value* form = tl_builtin_list(TL_SEXPR, n, a);
+  tl_val_add(form, NULL);
+  memmove(&form->cell[1], &form->cell[0], sizeof(Value*) * n);
+  form->cell[0] = tl_val_symbol("match");
 
-  int r;
-  if (strcmp(op, "==") == 0) {
-    r = tl_val_eq(a->cell[0], a->cell[1]);
+  Value* err = tl_match_compile(form);
+  if (err) {
+    tl_val_delete(form);
+    return err;
   }
-  if (strcmp(op, "!=") == 0) {
-    r = !tl_val_eq(a->cell[0], a->cell[1]);
+
+  MatchNode* leaf = tl_match_find(form->match, a[0]);
+  Value* x = leaf ? NULL
+    : tl_val_error("Function 'match' found no pattern matching %s", tl_type_name(a[0]->type));
+  if (leaf) {
+    Env* scope = tl_env_new();
+    scope->parent = e;
+    tl_match_bind(leaf, a[0], scope);
+    x = tl_machine_body(scope, form->cell[3 + 2 * leaf->clause]);
+    tl_env_delete(scope);
   }
-  tl_val_delete(a);
-  return tl_val_num(r);
+  tl_val_delete(form);
+  return x;
 }
 
-Value* builtin_gt(Env* e, Value* v) { return builtin_ord(e, v, ">" ); }
-Value* builtin_ge(Env* e, Value* v) { return builtin_ord(e, v, ">="); }
-Value* builtin_lt(Env* e, Value* v) { return builtin_ord(e, v, "<" ); }
-Value* builtin_le(Env* e, Value* v) { return builtin_ord(e, v, "<="); }
+/* Loops run their body in place with 'tl_machine_body' rather than
+ * copying it for every pass. The loop variable is bound in the caller's
+ * environment, where '=' in the body can also see its other locals, and
+ * the same binding is updated from one pass to the next. */
+static int tl_builtin_slot(Env* e, Value* sym, Value* x) {
+  tl_env_set(e, sym, x);
+  for (int i=0; i < e->count; i++) {
+    if (strcmp(e->syms[i], sym->sym) == 0) return i;
+  }
+  return -1;
+}
 
-Value* builtin_eq(Env* e, Value* a) { return builtin_cmp(e, a, "=="); }
-Value* builtin_ne(Env* e, Value* a) { return builtin_cmp(e, a, "!="); }
+// Runs one pass of a loop body; anything but an error is discarded
+static Value* tl_builtin_pass(Env* e, Value* body) {
+  Value* x = tl_machine_body(e, body);
+  if (x->type == TL_ERROR) return x;
+  tl_val_delete(x);
+  return NULL;
+}
 
-Value* builtin_if(Env* e, Value* a) {
-  TL_ASSERT_NUM("if", a, 3);
-  TL_ASSERT_TYPE("if", a, 0, TL_INTEGER);
-  TL_ASSERT_TYPE("if", a, 1, TL_QEXPR);
-  TL_ASSERT_TYPE("if", a, 2, TL_QEXPR);
+Value* builtin_while(Env* e, int n, Value** a) {
+  while (1) {
+    Value* c = tl_machine_body(e, a[0]);
+    if (c->type == TL_ERROR) return c;
+    if (c->type != TL_INTEGER) {
+      Value* err = tl_val_error(
+          "Function 'while' condition returned incorrect type. Got %s, expected %s",
+          tl_type_name(c->type), tl_type_name(TL_INTEGER));
+      tl_val_delete(c);
+      return err;
+    }
+    long go = c->num;
+    tl_val_delete(c);
+    if (!go) break;
 
-  Value* x;
-  a->cell[1]->type = TL_SEXPR;
-  a->cell[2]->type = TL_SEXPR;
+    Value* err = tl_builtin_pass(e, a[1]);
+    if (err) return err;
+  }
+  return tl_val_sexpr();
+}
+
+Value* builtin_for(Env* e, int n, Value** a) {
+  TL_ASSERT(a[0]->count == 1 && a[0]->cell[0]->type == TL_SYMBOL,
+      "Function 'for' needs a single symbol to bind");
+
+  int slot = -1;
+  for (long i = a[1]->num; i < a[2]->num; i++) {
+    if (slot < 0) {
+      slot = tl_builtin_slot(e, a[0]->cell[0], tl_val_num(i));
+    } else if (e->vals[slot]->type == TL_INTEGER) {
+      e->vals[slot]->num = i;
+    } else {
+      tl_val_delete(e->vals[slot]);
+      e->vals[slot] = tl_val_num(i);
+    }
+
+    Value* err = tl_builtin_pass(e, a[3]);
+    if (err) return err;
+  }
+  return tl_val_sexpr();
+}
+
+Value* builtin_each(Env* e, int n, Value** a) {
+  TL_ASSERT(a[0]->count == 1 && a[0]->cell[0]->type == TL_SYMBOL,
+      "Function 'each' needs a single symbol to bind");
+
+  int slot = -1;
+  for (int i=0; i < a[1]->count; i++) {
+    Value* x = a[1]->cell[i];
+    if (slot < 0) {
+      slot = tl_builtin_slot(e, a[0]->cell[0], tl_val_copy(x));
+    } else if (e->vals[slot]->type == TL_INTEGER && x->type == TL_INTEGER) {
+      e->vals[slot]->num = x->num;
+    } else {
+      tl_val_delete(e->vals[slot]);
+      e->vals[slot] = tl_val_copy(x);
+    }
 
-  if (a->cell[0]->num) {
-    x = tl_val_eval(e, tl_val_pop(a, 1));
-  } else {
-    x = tl_val_eval(e, tl_val_pop(a, 2));
+    Value* err = tl_builtin_pass(e, a[2]);
+    if (err) return err;
   }
-  
-  tl_val_delete(a);
+  return tl_val_sexpr();
+}
+
+/* Builtins that capture or suspend the evaluator only work from inside
+ * it, so a direct call re-enters the machine with the same arguments. */
+static Value* tl_builtin_machine(Env* e, tl_builtin fn, int n, Value** a) {
+  Value* f = tl_val_fun(tl_builtin_find(fn));
+  Value* x = tl_machine_apply(e, f, n, a);
+  tl_val_delete(f);
   return x;
 }
+
+Value* builtin_callcc(Env* e, int n, Value** a) {
+  return tl_builtin_machine(e, builtin_callcc, n, a);
+}
+
+Value* builtin_continue(Env* e, int n, Value** a) {
+  return tl_val_error("Continuation called without its context");
+}
+
+Value* builtin_yield(Env* e, int n, Value** a) {
+  return tl_builtin_machine(e, builtin_yield, n, a);
+}
+
+/* (try {body} {err} {handler}) is the value of 'body', or if that is an
+ * error, of 'handler' with the message bound to 'err'. The machine runs
+ * it as a special form, where an error unwinds straight to the 'try'. */
+Value* builtin_try(Env* e, int n, Value** a) {
+  TL_ASSERT(a[1]->count == 1 && a[1]->cell[0]->type == TL_SYMBOL,
+    "Function 'try' passed an invalid variable. Expected a single symbol");
+  Value* x = tl_machine_body(e, a[0]);
+  if (x->type != TL_ERROR || x->num) return x;
+  tl_env_set(e, a[1]->cell[0], tl_val_string(x->err));
+  tl_val_delete(x);
+  return tl_machine_body(e, a[2]);
+}
+
+Value* builtin_throw(Env* e, int n, Value** a) {
+  return tl_val_error("%s", a[0]->str);
+}
+
+Value* builtin_generator(Env* e, int n, Value** a) {
+  Value* v = malloc(sizeof(Value));
+  v->type = TL_GENERATOR;
+  v->machine = tl_machine_new();
+  v->machine->start = tl_builtin_list(TL_SEXPR, n, a);
+  return v;
+}
+
+Value* builtin_next(Env* e, int n, Value** a) {
+  return tl_machine_resume(a[0]->machine, e);
+}
@@ -4,47 +4,107 @@
 
 #include "value.h"
 
-#define TL_ASSERT(args, cond, fmt, ...) \
+/* Builtins borrow their arguments: 'a' holds 'n' values owned by the
+ * caller and the builtin returns a fresh result. Arity and argument types
+ * are checked from the descriptor in 'tl_builtins' before the call. */
+
+#define TL_ASSERT(cond, fmt, ...) \
   if (!(cond)) { \
-    Value* err = tl_val_error(fmt, ##__VA_ARGS__); \
-    tl_val_delete(args); \
-    return err; \
+    return tl_val_error(fmt, ##__VA_ARGS__); \
   }
 
-#define TL_ASSERT_NUM(fn, args, num) \
-  TL_ASSERT(args, args->count == num, \
-      "Function '%s' passed incorrect number of arguments. Got: %s, expected: %s", \
-      fn, args->count, num)
-
-#define TL_ASSERT_TYPE(func, args, index, expect) \
-  TL_ASSERT(args, args->cell[index]->type == expect, \
-    "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
-    func, index, tl_type_name(args->cell[index]->type), tl_type_name(expect))
-
-Value* builtin_op(Env*, Value*, char*);
-Value* builtin_list(Env*, Value*);
-Value* builtin_head(Env*, Value*);
-Value* builtin_tail(Env*, Value*);
-Value* builtin_eval(Env*, Value*);
-Value* builtin_join(Env*, Value*);
-Value* builtin_lambda(Env*, Value*);
-Value* builtin_var(Env*, Value*, char*);
-Value* builtin_def(Env*, Value*);
-Value* builtin_put(Env*, Value*);
-
-Value* builtin_add      (Env*, Value*);
-Value* builtin_subtract (Env*, Value*);
-Value* builtin_multiply (Env*, Value*);
-Value* builtin_divide   (Env*, Value*);
-
-Value* builtin_eq  (Env*, Value*);
-Value* builtin_ne  (Env*, Value*);
-Value* builtin_gt  (Env*, Value*);
-Value* builtin_ge  (Env*, Value*);
-Value* builtin_lt  (Env*, Value*);
-Value* builtin_le  (Env*, Value*);
-Value* builtin_ord (Env*, Value*, char*);
-
-Value* builtin_if  (Env*, Value*);
+extern Builtin tl_builtins[];
+
+Value*   tl_builtin_check(Builtin*, int, Value**);
+Value*   tl_builtin_call(Env*, Builtin*, int, Value**);
+Value*   tl_builtin_apply(Env*, Value*, int, Value**);
+Builtin* tl_builtin_find(tl_builtin);
+
+Value* builtin_list(Env*, int, Value**);
+Value* builtin_head(Env*, int, Value**);
+Value* builtin_tail(Env*, int, Value**);
+Value* builtin_eval(Env*, int, Value**);
+Value* builtin_join(Env*, int, Value**);
+Value* builtin_map(Env*, int, Value**);
+Value* builtin_filter(Env*, int, Value**);
+Value* builtin_foldl(Env*, int, Value**);
+Value* builtin_foldr(Env*, int, Value**);
+Value* builtin_reduce(Env*, int, Value**);
+Value* builtin_take(Env*, int, Value**);
+
+Value* builtin_range(Env*, int, Value**);
+Value* builtin_iterate(Env*, int, Value**);
+Value* builtin_repeat(Env*, int, Value**);
+
+Value* builtin_memo(Env*, int, Value**);
+Value* builtin_memo_stats(Env*, int, Value**);
+Value* builtin_intern(Env*, int, Value**);
+Value* builtin_specialize(Env*, int, Value**);
+
+Value* builtin_defrecord(Env*, int, Value**);
+Value* builtin_record(Env*, int, Value**);
+Value* builtin_record_get(Env*, int, Value**);
+Value* builtin_record_with(Env*, int, Value**);
+Value* builtin_record_is(Env*, int, Value**);
+
+Value* builtin_defcell(Env*, int, Value**);
+Value* builtin_batch(Env*, int, Value**);
+Value* builtin_cell_stats(Env*, int, Value**);
+
+Value* builtin_xmap(Env*, int, Value**);
+Value* builtin_xfilter(Env*, int, Value**);
+Value* builtin_xtake(Env*, int, Value**);
+Value* builtin_xdrop(Env*, int, Value**);
+Value* builtin_xtake_while(Env*, int, Value**);
+Value* builtin_xdrop_while(Env*, int, Value**);
+Value* builtin_transduce(Env*, int, Value**);
+Value* builtin_into(Env*, int, Value**);
+Value* builtin_lambda(Env*, int, Value**);
+Value* builtin_var(Env*, int, Value**, char*, int);
+Value* builtin_def(Env*, int, Value**);
+Value* builtin_put(Env*, int, Value**);
+Value* builtin_quote(Env*, int, Value**);
+Value* builtin_defmacro(Env*, int, Value**);
+
+/* Arithmetic and ordering kernels. Each entry expands into a builtin
+ * specialised for its operator and into its descriptor, so a call is a
+ * single indirect call with no dispatch on the operator name. */
+#define TL_ARITH_OPS(X) \
+  X(add,      "+", +, x)  \
+  X(subtract, "-", -, -x) \
+  X(multiply, "*", *, x)
+
+#define TL_ORD_OPS(X) \
+  X(gt, ">",  >)  \
+  X(lt, "<",  <)  \
+  X(ge, ">=", >=) \
+  X(le, "<=", <=)
+
+#define TL_DECLARE(name, ...) Value* builtin_##name(Env*, int, Value**);
+TL_ARITH_OPS(TL_DECLARE)
+TL_ORD_OPS(TL_DECLARE)
+
+Value* builtin_divide   (Env*, int, Value**);
+
+Value* builtin_eq  (Env*, int, Value**);
+Value* builtin_ne  (Env*, int, Value**);
+
+Value* builtin_if   (Env*, int, Value**);
+Value* builtin_match(Env*, int, Value**);
+
+Value* builtin_while (Env*, int, Value**);
+Value* builtin_for   (Env*, int, Value**);
+Value* builtin_each  (Env*, int, Value**);
+
+Value* builtin_callcc    (Env*, int, Value**);
+Value* builtin_continue  (Env*, int, Value**);
+Value* builtin_yield     (Env*, int, Value**);
+Value* builtin_try       (Env*, int, Value**);
+Value* builtin_throw     (Env*, int, Value**);
+Value* builtin_generator (Env*, int, Value**);
+Value* builtin_next      (Env*, int, Value**);
+
+int           tl_val_eq(Value*, Value*);
+unsigned long tl_val_hash(Value*);
 
 #endif
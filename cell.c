@@ -0,0 +1,287 @@
+
+#include "cell.h"
+#include "builtins.h"
+#include "machine.h"
+
+// The cell being worked out, whose reads are recorded
+Cell* tl_cell_current = NULL;
+
+/* Every name a cell reads or is bound to has an entry, holding the cell
+ * of that name, if any, and the cells that read it. */
+typedef struct tl_cell_entry Entry;
+
+struct tl_cell_entry {
+  char* name;
+  Cell* cell;
+  int count;
+  Cell** readers;
+  Entry* next;
+};
+
+static Entry** tl_cell_table = NULL;
+static int tl_cell_size = 0;
+static int tl_cell_entries = 0;
+
+// Every cell, in the order they were defined
+static Cell* tl_cells = NULL;
+static Cell* tl_cells_last = NULL;
+static long tl_cell_ids = 0;
+static long tl_cell_count = 0;
+
+// Cells to work out again once the current change is done
+static Cell** tl_cell_dirty = NULL;
+static int tl_cell_ndirty = 0;
+static int tl_cell_capacity = 0;
+static int tl_cell_batching = 0;
+static long tl_cell_passes = 0;
+
+static unsigned long tl_cell_hash(char* s) {
+  unsigned long h = 5381;
+  while (*s) h = h * 33 + (unsigned char)*s++;
+  return h;
+}
+
+static void tl_cell_grow(void) {
+  int size = tl_cell_size ? tl_cell_size * 2 : 64;
+  Entry** table = calloc(size, sizeof(Entry*));
+  for (int i=0; i < tl_cell_size; i++) {
+    Entry* x = tl_cell_table[i];
+    while (x) {
+      Entry* next = x->next;
+      unsigned long h = tl_cell_hash(x->name) % size;
+      x->next = table[h];
+      table[h] = x;
+      x = next;
+    }
+  }
+  free(tl_cell_table);
+  tl_cell_table = table;
+  tl_cell_size = size;
+}
+
+static Entry* tl_cell_entry(char* name, int create) {
+  if (create && tl_cell_entries >= tl_cell_size) tl_cell_grow();
+  if (!tl_cell_size) return NULL;
+
+  unsigned long h = tl_cell_hash(name) % tl_cell_size;
+  for (Entry* x = tl_cell_table[h]; x; x = x->next) {
+    if (strcmp(x->name, name) == 0) return x;
+  }
+  if (!create) return NULL;
+
+  Entry* x = calloc(1, sizeof(Entry));
+  x->name = malloc(strlen(name) + 1);
+  strcpy(x->name, name);
+  x->next = tl_cell_table[h];
+  tl_cell_table[h] = x;
+  tl_cell_entries++;
+  return x;
+}
+
+// Records that the cell being worked out read 'sym'
+void tl_cell_read(Value* sym) {
+  Cell* c = tl_cell_current;
+  if (strcmp(sym->sym, c->name->sym) == 0) return;
+  for (int i=0; i < c->count; i++) {
+    if (strcmp(c->deps[i], sym->sym) == 0) return;
+  }
+  c->count++;
+  c->deps = realloc(c->deps, sizeof(char*) * c->count);
+  c->deps[c->count - 1] = malloc(strlen(sym->sym) + 1);
+  strcpy(c->deps[c->count - 1], sym->sym);
+}
+
+static void tl_cell_register(Cell* c) {
+  for (int i=0; i < c->count; i++) {
+    Entry* x = tl_cell_entry(c->deps[i], 1);
+    x->count++;
+    x->readers = realloc(x->readers, sizeof(Cell*) * x->count);
+    x->readers[x->count - 1] = c;
+  }
+}
+
+static void tl_cell_unregister(Cell* c) {
+  for (int i=0; i < c->count; i++) {
+    Entry* x = tl_cell_entry(c->deps[i], 0);
+    for (int j=0; j < x->count; j++) {
+      if (x->readers[j] == c) {
+        x->readers[j] = x->readers[--x->count];
+        break;
+      }
+    }
+    free(c->deps[i]);
+  }
+  free(c->deps);
+  c->deps = NULL;
+  c->count = 0;
+}
+
+/* Lifts the cells that read 'c' above it. No chain without a cycle is
+ * as long as the number of cells, so heights stop there. */
+static void tl_cell_raise(Cell* c) {
+  Entry* x = tl_cell_entry(c->name->sym, 0);
+  long h = c->height + 1 < tl_cell_count ? c->height + 1 : tl_cell_count;
+  for (int i=0; x && i < x->count; i++) {
+    Cell* r = x->readers[i];
+    if (r->height >= h) continue;
+    r->height = h;
+    tl_cell_raise(r);
+  }
+}
+
+/* Marks the cells that read 'name' to be worked out again. With cell
+ * 'from' changed in the current pass, one that was worked out already is
+ * marked only if it comes after 'from'. */
+static void tl_cell_mark(char* name, Cell* from) {
+  Entry* x = tl_cell_entry(name, 0);
+  if (!x) return;
+  for (int i=0; i < x->count; i++) {
+    Cell* c = x->readers[i];
+    if (c->dirty) continue;
+    if (from && c->pass == from->pass && c->height <= from->height) continue;
+    if (tl_cell_ndirty == tl_cell_capacity) {
+      tl_cell_capacity = tl_cell_capacity ? tl_cell_capacity * 2 : 16;
+      tl_cell_dirty = realloc(tl_cell_dirty, sizeof(Cell*) * tl_cell_capacity);
+    }
+    c->dirty = 1;
+    tl_cell_dirty[tl_cell_ndirty++] = c;
+  }
+}
+
+/* Works out the value of 'c' again, recording what it reads, and returns
+ * whether the value changed. */
+static int tl_cell_compute(Cell* c) {
+  tl_cell_unregister(c);
+  Cell* prev = tl_cell_current;
+  tl_cell_current = c;
+  c->computing++;
+  Value* x = tl_machine_body(c->env, c->expr);
+  c->computing--;
+  tl_cell_current = prev;
+  tl_cell_register(c);
+  c->recomputes++;
+
+  long height = 0;
+  for (int i=0; i < c->count; i++) {
+    Entry* d = tl_cell_entry(c->deps[i], 0);
+    if (d->cell && d->cell->height >= height) height = d->cell->height + 1;
+  }
+  c->height = height < tl_cell_count ? height : tl_cell_count;
+  tl_cell_raise(c);
+
+  Value* old = tl_env_lookup(c->env, c->name);
+  int changed = !old || !tl_val_eq(old, x);
+  tl_env_set(c->env, c->name, x);
+  return changed;
+}
+
+/* Works out the marked cells, lowest first, and then those that read a
+ * cell whose value changed. */
+static void tl_cell_flush(void) {
+  long pass = ++tl_cell_passes;
+  tl_cell_batching++;
+  while (tl_cell_ndirty) {
+    int k = 0;
+    for (int i=1; i < tl_cell_ndirty; i++) {
+      Cell* a = tl_cell_dirty[i];
+      Cell* b = tl_cell_dirty[k];
+      if (a->height < b->height || (a->height == b->height && a->id < b->id)) k = i;
+    }
+    Cell* c = tl_cell_dirty[k];
+    tl_cell_dirty[k] = tl_cell_dirty[--tl_cell_ndirty];
+    c->dirty = 0;
+
+    c->pass = pass;
+    if (tl_cell_compute(c)) tl_cell_mark(c->name->sym, c);
+  }
+  tl_cell_batching--;
+}
+
+static void tl_cell_drop(Cell* c) {
+  tl_cell_unregister(c);
+  for (int i=0; i < tl_cell_ndirty; i++) {
+    if (tl_cell_dirty[i] == c) {
+      tl_cell_dirty[i] = tl_cell_dirty[--tl_cell_ndirty];
+      break;
+    }
+  }
+
+  Cell** p = &tl_cells;
+  Cell* last = NULL;
+  while (*p != c) {
+    last = *p;
+    p = &(*p)->next;
+  }
+  *p = c->next;
+  if (tl_cells_last == c) tl_cells_last = last;
+
+  tl_val_delete(c->name);
+  tl_val_delete(c->expr);
+  free(c);
+  tl_cell_count--;
+}
+
+// Defines cell 'name' for code 'expr', both borrowed, replacing any other
+Value* tl_cell_define(Env* e, Value* name, Value* expr) {
+  while (e->parent) e = e->parent;
+
+  Entry* x = tl_cell_entry(name->sym, 1);
+  if (x->cell) {
+    TL_ASSERT(!x->cell->computing,
+      "Function 'defcell' cannot redefine cell '%s' while it is worked out", name->sym);
+    tl_cell_drop(x->cell);
+  }
+
+  Cell* c = calloc(1, sizeof(Cell));
+  c->name = tl_val_copy(name);
+  c->expr = tl_val_copy(expr);
+  c->env = e;
+  c->id = ++tl_cell_ids;
+  tl_cell_count++;
+  if (tl_cells_last) tl_cells_last->next = c; else tl_cells = c;
+  tl_cells_last = c;
+  x->cell = c;
+
+  // Cells that read the name before it was a cell are worked out again
+  tl_cell_batching++;
+  tl_cell_compute(c);
+  tl_cell_mark(name->sym, NULL);
+  if (--tl_cell_batching == 0) tl_cell_flush();
+
+  Value* v = tl_env_lookup(e, name);
+  return v->type == TL_ERROR ? tl_val_copy(v) : tl_val_sexpr();
+}
+
+/* Called once the symbols in 'syms' have been assigned in 'e'. Changes
+ * to the top level are propagated to the cells that read them. */
+void tl_cell_changed(Env* e, Value* syms) {
+  if (e->parent || !tl_cell_size) return;
+  for (int i=0; i < syms->count; i++) tl_cell_mark(syms->cell[i]->sym, NULL);
+  if (!tl_cell_batching) tl_cell_flush();
+}
+
+// Evaluates 'body' in place, propagating its changes once at the end
+Value* tl_cell_batch(Env* e, Value* body) {
+  tl_cell_batching++;
+  Value* x = tl_machine_body(e, body);
+  if (--tl_cell_batching == 0) tl_cell_flush();
+  return x;
+}
+
+// {{name recomputes} ...} for the cells named in 'names', or all of them
+Value* tl_cell_stats(Value* names) {
+  Value* x = tl_val_qexpr();
+  for (Cell* c = tl_cells; c; c = c->next) {
+    int wanted = names->count == 0;
+    for (int i=0; i < names->count && !wanted; i++) {
+      wanted = names->cell[i]->type == TL_SYMBOL && strcmp(names->cell[i]->sym, c->name->sym) == 0;
+    }
+    if (!wanted) continue;
+
+    Value* s = tl_val_qexpr();
+    tl_val_add(s, tl_val_copy(c->name));
+    tl_val_add(s, tl_val_num(c->recomputes));
+    tl_val_add(x, s);
+  }
+  return x;
+}
@@ -0,0 +1,52 @@
+
+#ifndef CELL_H_INCLUDED_
+#define CELL_H_INCLUDED_
+
+#include "value.h"
+
+/* Reactive cells. (defcell {name} {expr}) binds 'name' globally to the
+ * value of 'expr' and records every symbol read while working it out.
+ * When one of those is assigned at the top level with '=' or 'def', or
+ * is itself a cell whose value changes, the cell is worked out again and
+ * its binding replaced. Nothing else is, so an update costs what the
+ * cells that depend on it cost.
+ *
+ * Changes are propagated in order of height: a cell that reads no other
+ * cell has height 0, and any other is one above the highest cell it
+ * reads. So a cell is worked out after the cells it reads, once per
+ * change even when several of them change. It is only worked out again
+ * when a cell it reads changes after it, which a cell read for the first
+ * time can do. Cells reading each other in a cycle share the greatest
+ * height and are not. Inside (batch {body}) propagation waits for the
+ * end of the body. */
+
+typedef struct tl_cell Cell;
+
+struct tl_cell {
+  Value* name;
+  Value* expr;
+  Env* env;
+
+  long id;
+  long height;
+  long recomputes;
+  long pass;
+  int dirty;
+  int computing;
+
+  // The names read the last time the cell was worked out
+  int count;
+  char** deps;
+
+  Cell* next;
+};
+
+extern Cell* tl_cell_current;
+
+Value* tl_cell_define(Env*, Value*, Value*);
+void   tl_cell_read(Value*);
+void   tl_cell_changed(Env*, Value*);
+Value* tl_cell_batch(Env*, Value*);
+Value* tl_cell_stats(Value*);
+
+#endif
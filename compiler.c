@@ -0,0 +1,810 @@
+
+#include <limits.h>
+#include <stdarg.h>
+
+#include "compiler.h"
+#include "builtins.h"
+#include "optimize.h"
+
+typedef struct {
+  FILE* out;
+  int depth;
+  int temps;
+  int self;
+  int looped;
+  int boxed;
+
+  Value* consts;
+  Value* assigned;
+  Value* macros;
+
+  int count;
+  Value** defs;
+} tl_compiler;
+
+/* Runtime support emitted at the top of every generated file. Everything
+ * else the program needs comes from value.c, builtins.c and mpc.c. */
+static char* tl_compile_prelude =
+  "#include <limits.h>\n"
+  "#include <stdio.h>\n"
+  "#include <string.h>\n"
+  "\n"
+  "#include \"value.h\"\n"
+  "#include \"builtins.h\"\n"
+  "#include \"machine.h\"\n"
+  "#include \"cell.h\"\n"
+  "#include \"optimize.h\"\n"
+  "\n"
+  "Value* tl_c_error(int n, Value** a) {\n"
+  "  for (int i=0; i < n; i++) {\n"
+  "    if (a[i]->type == TL_ERROR) {\n"
+  "      Value* err = a[i];\n"
+  "      a[i] = NULL;\n"
+  "      return err;\n"
+  "    }\n"
+  "  }\n"
+  "  return NULL;\n"
+  "}\n"
+  "\n"
+  "void tl_c_free(int n, Value** a) {\n"
+  "  for (int i=0; i < n; i++) if (a[i]) tl_val_delete(a[i]);\n"
+  "}\n"
+  "\n"
+  "Value* tl_c_apply(Env* e, Builtin* b, int n, Value** a) {\n"
+  "  Value* r = tl_c_error(n, a);\n"
+  "  if (!r) r = tl_builtin_call(e, b, n, a);\n"
+  "  tl_c_free(n, a);\n"
+  "  return r;\n"
+  "}\n"
+  "\n"
+  "Value* tl_c_call(Env* e, tl_builtin f, int n, Value** a) {\n"
+  "  Value* r = tl_c_error(n, a);\n"
+  "  if (!r) r = f(e, n, a);\n"
+  "  tl_c_free(n, a);\n"
+  "  return r;\n"
+  "}\n"
+  "\n"
+  "Value* tl_c_eval(Env* e, int n, Value** a) {\n"
+  "  Value* r = tl_c_error(n, a);\n"
+  "  if (!r && a[0]->type != TL_FUNCTION) {\n"
+  "    r = tl_val_error(\n"
+  "        \"S-expression starts with incorrect type. \"\n"
+  "        \"Got %s, expected %s.\",\n"
+  "        tl_type_name(a[0]->type), tl_type_name(TL_FUNCTION));\n"
+  "  }\n"
+  "  if (!r) r = tl_val_call(e, a[0], n-1, a+1);\n"
+  "  tl_c_free(n, a);\n"
+  "  return r;\n"
+  "}\n"
+  "\n"
+  "Value* tl_c_if_error(Value* c) {\n"
+  "  if (c->type == TL_ERROR) return c;\n"
+  "  Value* err = tl_val_error(\n"
+  "      \"Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.\",\n"
+  "      \"if\", 0, tl_type_name(c->type), tl_type_name(TL_INTEGER));\n"
+  "  tl_val_delete(c);\n"
+  "  return err;\n"
+  "}\n"
+  "\n"
+  "Env* tl_c_frame(Env* p, int n, Value** a, Value* formals) {\n"
+  "  Env* e = tl_env_new();\n"
+  "  e->parent = p;\n"
+  "  e->count = n;\n"
+  "  e->syms = malloc(sizeof(char*) * n);\n"
+  "  e->vals = malloc(sizeof(Value*) * n);\n"
+  "  for (int i=0; i < n; i++) {\n"
+  "    e->syms[i] = malloc(strlen(formals->cell[i]->sym) + 1);\n"
+  "    strcpy(e->syms[i], formals->cell[i]->sym);\n"
+  "    e->vals[i] = tl_val_copy(a[i]);\n"
+  "  }\n"
+  "  return e;\n"
+  "}\n"
+  "\n"
+  "Value* tl_c_fallback(Env* e, int n, Value** a, Value* formals, Value* body) {\n"
+  "  Value* f = tl_val_lambda(tl_val_copy(formals), tl_val_copy(body));\n"
+  "  Value* result = tl_val_call(e, f, n, a);\n"
+  "  tl_val_delete(f);\n"
+  "  return result;\n"
+  "}\n"
+  "\n"
+  "void tl_c_rebind(Env* e, int n, Value** a) {\n"
+  "  for (int i=0; i < n; i++) {\n"
+  "    tl_val_delete(e->vals[i]);\n"
+  "    e->vals[i] = a[i];\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "tl_builtin tl_c_body(tl_builtin);\n"
+  "\n"
+  "tl_builtin tl_c_next;\n"
+  "int tl_c_next_count;\n"
+  "Value** tl_c_next_args;\n"
+  "Env* tl_c_next_env;\n"
+  "\n"
+  "Value* tl_c_tail(Env* e, tl_builtin f, int n, Value** a) {\n"
+  "  tl_c_next_env = e;\n"
+  "  tl_c_next = f;\n"
+  "  tl_c_next_count = n;\n"
+  "  tl_c_next_args = malloc(sizeof(Value*) * n);\n"
+  "  memcpy(tl_c_next_args, a, sizeof(Value*) * n);\n"
+  "  return NULL;\n"
+  "}\n"
+  "\n"
+  "Value* tl_c_tail_eval(Env* e, int n, Value** a) {\n"
+  "  tl_builtin f = a[0]->type == TL_FUNCTION && a[0]->builtin ? tl_c_body(a[0]->builtin->fn) : NULL;\n"
+  "  if (!f) return tl_c_tail(e, NULL, n, a);\n"
+  "  tl_val_delete(a[0]);\n"
+  "  return tl_c_tail(e, f, n-1, a+1);\n"
+  "}\n"
+  "\n"
+  "Value* tl_c_bounce(Env* p) {\n"
+  "  Env* caller = tl_c_next_env;\n"
+  "  Value* r = NULL;\n"
+  "  while (!r) {\n"
+  "    int k = tl_c_next_count;\n"
+  "    Value** next = tl_c_next_args;\n"
+  "    if (tl_c_next) {\n"
+  "      r = tl_c_next(caller, k, next);\n"
+  "      tl_c_free(k, next);\n"
+  "    } else {\n"
+  "      r = tl_c_eval(caller, k, next);\n"
+  "    }\n"
+  "    free(next);\n"
+  "    if (!r) {\n"
+  "      tl_env_merge(tl_c_next_env, caller);\n"
+  "      tl_env_delete(caller);\n"
+  "      caller = tl_c_next_env;\n"
+  "      caller->parent = p;\n"
+  "    }\n"
+  "  }\n"
+  "  tl_env_delete(caller);\n"
+  "  return r;\n"
+  "}\n"
+  "\n"
+  "Value* tl_c_run(Env* p, tl_builtin f, int n, Value** a) {\n"
+  "  Value* r = f(p, n, a);\n"
+  "  return r ? r : tl_c_bounce(p);\n"
+  "}\n"
+  "\n"
+  "void tl_c_print(Value* v) {\n"
+  "  if (v->type != TL_SEXPR || v->count != 0) {\n"
+  "    tl_val_print(v);\n"
+  "    puts(\"\");\n"
+  "  }\n"
+  "  tl_val_delete(v);\n"
+  "}\n"
+  "\n";
+
+static void tl_compile_line(tl_compiler* c, char* fmt, ...) {
+  for (int i=0; i < c->depth; i++) fputs("  ", c->out);
+
+  va_list va;
+  va_start(va, fmt);
+  vfprintf(c->out, fmt, va);
+  va_end(va);
+
+  fputc('\n', c->out);
+}
+
+static void tl_compile_string(FILE* out, char* s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    unsigned char ch = *s;
+    if (ch == '"' || ch == '\\' || ch == '?') {
+      fprintf(out, "\\%c", ch);
+    } else if (ch < 32 || ch > 126) {
+      fprintf(out, "\\%03o", ch);
+    } else {
+      fputc(ch, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void tl_compile_copy(FILE* out, FILE* in) {
+  char buf[4096];
+  size_t n;
+  rewind(in);
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, out);
+  fclose(in);
+}
+
+static int tl_compile_const(tl_compiler* c, Value* v) {
+  for (int i=0; i < c->consts->count; i++) {
+    if (tl_val_eq(c->consts->cell[i], v)) return i;
+  }
+  tl_val_add(c->consts, tl_val_copy(v));
+  return c->consts->count - 1;
+}
+
+static int tl_compile_is(Value* v, char* sym) {
+  return v->type == TL_SYMBOL && strcmp(v->sym, sym) == 0;
+}
+
+static int tl_compile_member(Value* syms, char* sym) {
+  for (int i=0; i < syms->count; i++) {
+    if (strcmp(syms->cell[i]->sym, sym) == 0) return 1;
+  }
+  return 0;
+}
+
+// Collects the names of every macro 'v' defines
+static void tl_compile_macros(Value* v, Value* macros) {
+  if (v->type != TL_SEXPR && v->type != TL_QEXPR) return;
+  if (v->count == 4 && tl_compile_is(v->cell[0], "defmacro") && v->cell[1]->type == TL_QEXPR
+      && v->cell[1]->count == 1 && v->cell[1]->cell[0]->type == TL_SYMBOL) {
+    tl_val_add(macros, tl_val_copy(v->cell[1]->cell[0]));
+  }
+  for (int i=0; i < v->count; i++) tl_compile_macros(v->cell[i], macros);
+}
+
+static int tl_compile_assigned(tl_compiler* c, char* sym) {
+  int n = 0;
+  for (int i=0; i < c->assigned->count; i++) {
+    if (strcmp(c->assigned->cell[i]->sym, sym) == 0) n++;
+  }
+  return n;
+}
+
+/* Matches (def {name} (\ {formals} {body})) with plain symbol formals. */
+static int tl_compile_is_def(tl_compiler* c, Value* v) {
+  if (v->type != TL_SEXPR || v->count != 3) return 0;
+  if (!tl_compile_is(v->cell[0], "def") || tl_compile_assigned(c, "def")) return 0;
+  if (v->cell[1]->type != TL_QEXPR || v->cell[1]->count != 1) return 0;
+  if (v->cell[1]->cell[0]->type != TL_SYMBOL) return 0;
+
+  Value* l = v->cell[2];
+  if (l->type != TL_SEXPR || l->count != 3) return 0;
+  if (!tl_compile_is(l->cell[0], "\\") || tl_compile_assigned(c, "\\")) return 0;
+  if (l->cell[1]->type != TL_QEXPR || l->cell[2]->type != TL_QEXPR) return 0;
+
+  for (int i=0; i < l->cell[1]->count; i++) {
+    if (l->cell[1]->cell[i]->type != TL_SYMBOL) return 0;
+    if (tl_compile_is(l->cell[1]->cell[i], "&")) return 0;
+  }
+  return 1;
+}
+
+static int tl_compile_builtin(tl_compiler* c, Value* v) {
+  if (v->type != TL_SYMBOL || tl_compile_assigned(c, v->sym)) return -1;
+  for (int i=0; tl_builtins[i].fn; i++) {
+    if (strcmp(tl_builtins[i].name, v->sym) == 0) return i;
+  }
+  return -1;
+}
+
+static int tl_compile_function(tl_compiler* c, Value* v) {
+  if (v->type != TL_SYMBOL || tl_compile_assigned(c, v->sym) != 1) return -1;
+  for (int i=0; i < c->count; i++) {
+    if (strcmp(c->defs[i]->cell[1]->cell[0]->sym, v->sym) == 0) return i;
+  }
+  return -1;
+}
+
+static int tl_compile_slot(Value* formals, Value* v) {
+  if (!formals) return -1;
+  for (int i=0; i < formals->count; i++) {
+    if (strcmp(formals->cell[i]->sym, v->sym) == 0) return i;
+  }
+  return -1;
+}
+
+static int tl_compile_formals(Value* v) {
+  if (v->type != TL_QEXPR) return 0;
+  for (int i=0; i < v->count; i++) {
+    if (v->cell[i]->type != TL_SYMBOL) return 0;
+  }
+  return 1;
+}
+
+static int tl_compile_expr(tl_compiler*, Value*, Value*, int);
+
+/* The C operator an integer builtin compiles to, taken from the same
+ * tables as its kernel, or NULL. 'n' is the number of operands. */
+static char* tl_compile_operator(tl_builtin fn, int n) {
+#define TL_COMPILE_ARITH(name, sym, op, ...) if (fn == builtin_##name) return #op;
+#define TL_COMPILE_ORD(name, sym, op) if (fn == builtin_##name && n == 2) return #op;
+  TL_ARITH_OPS(TL_COMPILE_ARITH)
+  TL_ORD_OPS(TL_COMPILE_ORD)
+  if (fn == builtin_eq && n == 2) return "==";
+  if (fn == builtin_ne && n == 2) return "!=";
+  return NULL;
+}
+
+static int tl_compile_sexpr(tl_compiler*, Value*, Value*, int);
+static int tl_compile_operation(tl_compiler*, Value*, Value*, int*);
+
+/* Type inference for integer code. An expression is proven to be an
+ * integer when it is a literal, or an arithmetic or comparison builtin
+ * applied to proven integers, provided the formals it reads hold
+ * integers. Those formals are marked in 'used', to be tested once at run
+ * time before an unchecked path that needs no tag checks or boxing. */
+static int tl_compile_integer(tl_compiler* c, Value* v, Value* formals, int* used) {
+  if (v->type == TL_INTEGER) return 1;
+
+  if (v->type == TL_SYMBOL) {
+    int slot = tl_compile_slot(formals, v);
+    if (slot >= 0) used[slot] = 1;
+    return slot >= 0;
+  }
+
+  return v->type == TL_SEXPR && tl_compile_operation(c, v, formals, used);
+}
+
+// Checks the operator and operands of integer operation 'v'
+static int tl_compile_operation(tl_compiler* c, Value* v, Value* formals, int* used) {
+  if (v->count < 2) return 0;
+  if (v->cell[0]->type != TL_SYMBOL || tl_compile_slot(formals, v->cell[0]) >= 0) return 0;
+  int builtin = tl_compile_builtin(c, v->cell[0]);
+  if (builtin < 0 || !tl_compile_operator(tl_builtins[builtin].fn, v->count - 1)) return 0;
+
+  for (int i=1; i < v->count; i++) {
+    if (!tl_compile_integer(c, v->cell[i], formals, used)) return 0;
+  }
+  return 1;
+}
+
+// Writes proven integer expression 'v' as a C expression of type long
+static void tl_compile_unboxed(tl_compiler* c, Value* v, Value* formals) {
+  if (v->type == TL_INTEGER) {
+    if (v->num == LONG_MIN) {
+      fputs("LONG_MIN", c->out);
+    } else {
+      fprintf(c->out, "%ldL", v->num);
+    }
+    return;
+  }
+
+  if (v->type == TL_SYMBOL) {
+    fprintf(c->out, "e->vals[%i]->num", tl_compile_slot(formals, v));
+    return;
+  }
+
+  tl_builtin fn = tl_builtins[tl_compile_builtin(c, v->cell[0])].fn;
+  char* op = tl_compile_operator(fn, v->count - 1);
+  fputc('(', c->out);
+  if (v->count == 2 && fn == builtin_subtract) fputc('-', c->out);
+  for (int i=1; i < v->count; i++) {
+    if (i > 1) fprintf(c->out, " %s ", op);
+    tl_compile_unboxed(c, v->cell[i], formals);
+  }
+  fputc(')', c->out);
+}
+
+// Tests every formal marked in 'used' for an integer
+static void tl_compile_guard(tl_compiler* c, Value* formals, int* used) {
+  for (int i=0; i < c->depth; i++) fputs("  ", c->out);
+  fputs("if (", c->out);
+  int first = 1;
+  for (int i=0; i < formals->count; i++) {
+    if (!used[i]) continue;
+    fprintf(c->out, "%se->vals[%i]->type == TL_INTEGER", first ? "" : " && ", i);
+    first = 0;
+  }
+  fputs(") {\n", c->out);
+}
+
+/* Compiles proven integer expression 'v' to an unchecked path behind a
+ * guard on its formals, with the generic path as the fallback. */
+static int tl_compile_integer_sexpr(tl_compiler* c, Value* v, Value* formals, int* used) {
+  int t = c->temps++;
+  tl_compile_line(c, "Value* t%i;", t);
+  tl_compile_guard(c, formals, used);
+  c->depth++;
+  for (int i=0; i < c->depth; i++) fputs("  ", c->out);
+  fprintf(c->out, "t%i = tl_val_num(", t);
+  tl_compile_unboxed(c, v, formals);
+  fputs(");\n", c->out);
+  c->depth--;
+  tl_compile_line(c, "} else {");
+  c->depth++;
+  c->boxed++;
+  tl_compile_line(c, "t%i = t%i;", t, tl_compile_sexpr(c, v, formals, 0));
+  c->boxed--;
+  c->depth--;
+  tl_compile_line(c, "}");
+  return t;
+}
+
+static int tl_compile_sexpr(tl_compiler* c, Value* v, Value* formals, int tail) {
+  if (v->count == 0) {
+    int t = c->temps++;
+    tl_compile_line(c, "Value* t%i = tl_val_sexpr();", t);
+    return t;
+  }
+
+  if (v->count == 1) return tl_compile_expr(c, v->cell[0], formals, tail);
+
+  Value* head = v->cell[0];
+  int local = head->type == TL_SYMBOL && tl_compile_slot(formals, head) >= 0;
+  int builtin = local ? -1 : tl_compile_builtin(c, head);
+  int fn = local ? -1 : tl_compile_function(c, head);
+
+  // A macro call that could not be expanded ahead of time is left to the
+  // interpreter, which keeps the expansion in the constant's node, as is
+  // a 'match', which keeps its decision tree there, and a 'try', which
+  // errors in its body unwind to
+  if ((!local && head->type == TL_SYMBOL && tl_compile_member(c->macros, head->sym))
+      || (builtin >= 0 && (tl_builtins[builtin].fn == builtin_match
+        || tl_builtins[builtin].fn == builtin_try))) {
+    Value* q = tl_val_copy(v);
+    q->type = TL_QEXPR;
+    int t = c->temps++;
+    tl_compile_line(c, "Value* t%i = tl_machine_body(e, tl_k[%i]);", t, tl_compile_const(c, q));
+    tl_val_delete(q);
+    return t;
+  }
+
+  int* used = formals ? calloc(formals->count + 1, sizeof(int)) : NULL;
+  if (!c->boxed && formals && tl_compile_operation(c, v, formals, used)) {
+    int t = tl_compile_integer_sexpr(c, v, formals, used);
+    free(used);
+    return t;
+  }
+
+  // A proven integer condition is tested unboxed
+  if (used) memset(used, 0, sizeof(int) * formals->count);
+  if (builtin >= 0 && tl_builtins[builtin].fn == builtin_if && v->count == 4
+      && v->cell[2]->type == TL_QEXPR && v->cell[3]->type == TL_QEXPR
+      && !c->boxed && formals && tl_compile_integer(c, v->cell[1], formals, used)) {
+    int t = c->temps++;
+    int cond = c->temps++;
+
+    tl_compile_line(c, "Value* t%i = NULL;", t);
+    tl_compile_line(c, "long t%i = 0;", cond);
+    tl_compile_guard(c, formals, used);
+    c->depth++;
+    for (int i=0; i < c->depth; i++) fputs("  ", c->out);
+    fprintf(c->out, "t%i = ", cond);
+    tl_compile_unboxed(c, v->cell[1], formals);
+    fputs(";\n", c->out);
+    c->depth--;
+    tl_compile_line(c, "} else {");
+    c->depth++;
+    c->boxed++;
+    int boxed = tl_compile_expr(c, v->cell[1], formals, 0);
+    c->boxed--;
+    tl_compile_line(c, "if (t%i->type != TL_INTEGER) {", boxed);
+    tl_compile_line(c, "  t%i = tl_c_if_error(t%i);", t, boxed);
+    tl_compile_line(c, "} else {");
+    tl_compile_line(c, "  t%i = t%i->num;", cond, boxed);
+    tl_compile_line(c, "  tl_val_delete(t%i);", boxed);
+    tl_compile_line(c, "}");
+    c->depth--;
+    tl_compile_line(c, "}");
+    free(used);
+
+    tl_compile_line(c, "if (t%i) {", t);
+    tl_compile_line(c, "} else if (t%i) {", cond);
+    c->depth++;
+    tl_compile_line(c, "t%i = t%i;", t, tl_compile_sexpr(c, v->cell[2], formals, tail));
+    c->depth--;
+    tl_compile_line(c, "} else {");
+    c->depth++;
+    tl_compile_line(c, "t%i = t%i;", t, tl_compile_sexpr(c, v->cell[3], formals, tail));
+    c->depth--;
+    tl_compile_line(c, "}");
+    return t;
+  }
+  free(used);
+
+  if (builtin >= 0 && tl_builtins[builtin].fn == builtin_if && v->count == 4
+      && v->cell[2]->type == TL_QEXPR && v->cell[3]->type == TL_QEXPR) {
+    int cond = tl_compile_expr(c, v->cell[1], formals, 0);
+    int t = c->temps++;
+
+    tl_compile_line(c, "Value* t%i;", t);
+    tl_compile_line(c, "if (t%i->type != TL_INTEGER) {", cond);
+    c->depth++;
+    tl_compile_line(c, "t%i = tl_c_if_error(t%i);", t, cond);
+    c->depth--;
+    tl_compile_line(c, "} else if (t%i->num) {", cond);
+    c->depth++;
+    tl_compile_line(c, "tl_val_delete(t%i);", cond);
+    tl_compile_line(c, "t%i = t%i;", t, tl_compile_sexpr(c, v->cell[2], formals, tail));
+    c->depth--;
+    tl_compile_line(c, "} else {");
+    c->depth++;
+    tl_compile_line(c, "tl_val_delete(t%i);", cond);
+    tl_compile_line(c, "t%i = t%i;", t, tl_compile_sexpr(c, v->cell[3], formals, tail));
+    c->depth--;
+    tl_compile_line(c, "}");
+    return t;
+  }
+
+  if (builtin >= 0 && tl_builtins[builtin].fn == builtin_quote && v->count == 2) {
+    int t = c->temps++;
+    tl_compile_line(c, "Value* t%i = tl_val_copy(tl_k[%i]);", t, tl_compile_const(c, v->cell[1]));
+    return t;
+  }
+
+  if (builtin >= 0 && tl_builtins[builtin].fn == builtin_lambda && v->count == 3
+      && tl_compile_formals(v->cell[1]) && v->cell[2]->type == TL_QEXPR) {
+    int t = c->temps++;
+    int f = tl_compile_const(c, v->cell[1]);
+    int b = tl_compile_const(c, v->cell[2]);
+    if (c->macros->count) {
+      // Folded as 'builtin_lambda' folds, so macro calls are expanded once
+      tl_compile_line(c, "Value* t%i = tl_val_lambda(tl_val_copy(tl_k[%i]), "
+          "tl_opt_body(e, tl_val_copy(tl_k[%i]), tl_k[%i]));", t, f, b, f);
+    } else {
+      tl_compile_line(c, "Value* t%i = tl_val_lambda(tl_val_copy(tl_k[%i]), tl_val_copy(tl_k[%i]));",
+          t, f, b);
+    }
+    return t;
+  }
+
+  // Arguments are collected into an array temporary for the callee
+  int first = (builtin >= 0 || fn >= 0) ? 1 : 0;
+  int* args = malloc(sizeof(int) * v->count);
+  for (int i=first; i < v->count; i++)
+    args[i] = tl_compile_expr(c, v->cell[i], formals, 0);
+
+  int a = c->temps++;
+  for (int i=0; i < c->depth; i++) fputs("  ", c->out);
+  fprintf(c->out, "Value* t%i[] = {", a);
+  for (int i=first; i < v->count; i++) fprintf(c->out, " t%i%s", args[i], i+1 < v->count ? "," : " ");
+  fputs("};\n", c->out);
+  free(args);
+
+  int n = v->count - first;
+  int t = c->temps++;
+
+  // Call in tail position. A self call rebinds the frame and jumps back
+  // to the top, any other call returns to the trampoline in tl_c_run so
+  // that recursion through any function runs in constant stack, and a
+  // function value that turns out to be compiled is entered at its body.
+  // Either way the callee still sees the caller's other bindings, as
+  // scope is dynamic: the trampoline hands it the caller's frame.
+  if (tail && builtin < 0 && c->self >= 0) {
+    tl_compile_line(c, "Value* t%i = tl_c_error(%i, t%i);", t, n, a);
+    tl_compile_line(c, "if (!t%i) {", t);
+    if (fn == c->self && n == c->defs[fn]->cell[2]->cell[1]->count) {
+      tl_compile_line(c, "  tl_c_rebind(e, %i, t%i);", n, a);
+      tl_compile_line(c, "  goto tail;");
+      c->looped = 1;
+    } else if (fn >= 0) {
+      tl_compile_line(c, "  return tl_c_tail(e, tl_fb_%i, %i, t%i);", fn, n, a);
+    } else {
+      tl_compile_line(c, "  return tl_c_tail_eval(e, %i, t%i);", n, a);
+    }
+    tl_compile_line(c, "}");
+    tl_compile_line(c, "tl_c_free(%i, t%i);", n, a);
+    return t;
+  }
+
+  if (builtin >= 0) {
+    tl_compile_line(c, "Value* t%i = tl_c_apply(e, &tl_builtins[%i], %i, t%i);", t, builtin, n, a);
+  } else if (fn >= 0) {
+    tl_compile_line(c, "Value* t%i = tl_c_call(e, tl_fn_%i, %i, t%i);", t, fn, n, a);
+  } else {
+    tl_compile_line(c, "Value* t%i = tl_c_eval(e, %i, t%i);", t, n, a);
+  }
+  return t;
+}
+
+static int tl_compile_expr(tl_compiler* c, Value* v, Value* formals, int tail) {
+  int t;
+  switch (v->type) {
+    case TL_INTEGER:
+      t = c->temps++;
+      if (v->num == LONG_MIN) {
+        tl_compile_line(c, "Value* t%i = tl_val_num(LONG_MIN);", t);
+      } else {
+        tl_compile_line(c, "Value* t%i = tl_val_num(%ldL);", t, v->num);
+      }
+      return t;
+
+    case TL_SYMBOL:
+      t = c->temps++;
+      if (tl_compile_slot(formals, v) >= 0) {
+        tl_compile_line(c, "Value* t%i = tl_val_copy(e->vals[%i]);",
+            t, tl_compile_slot(formals, v));
+      } else {
+        int k = tl_compile_const(c, v);
+        tl_compile_line(c, "if (tl_cell_current) tl_cell_read(tl_k[%i]);", k);
+        tl_compile_line(c, "Value* t%i = tl_env_get(e, tl_k[%i]);", t, k);
+      }
+      return t;
+
+    case TL_SEXPR:
+      return tl_compile_sexpr(c, v, formals, tail);
+
+    default:
+      t = c->temps++;
+      tl_compile_line(c, "Value* t%i = tl_val_copy(tl_k[%i]);", t, tl_compile_const(c, v));
+      return t;
+  }
+}
+
+static void tl_compile_def(tl_compiler* c, int i) {
+  Value* lambda = c->defs[i]->cell[2];
+  Value* formals = lambda->cell[1];
+
+  FILE* out = c->out;
+  c->out = tmpfile();
+  c->depth = 1;
+  c->temps = 0;
+  c->self = i;
+  c->looped = 0;
+  c->boxed = 0;
+
+  int t = tl_compile_sexpr(c, lambda->cell[2], formals, 1);
+  tl_compile_line(c, "tl_env_delete(e);");
+  tl_compile_line(c, "return t%i;", t);
+
+  FILE* body = c->out;
+  c->out = out;
+  fprintf(c->out, "/* %s */\n", c->defs[i]->cell[1]->cell[0]->sym);
+  fprintf(c->out, "Value* tl_fb_%i(Env* p, int n, Value** a) {\n", i);
+  tl_compile_line(c, "if (n != %i) {", formals->count);
+  tl_compile_line(c, "  return tl_c_fallback(p, n, a, tl_k[%i], tl_k[%i]);",
+      tl_compile_const(c, formals), tl_compile_const(c, lambda->cell[2]));
+  tl_compile_line(c, "}");
+  tl_compile_line(c, "Env* e = tl_c_frame(p, n, a, tl_k[%i]);", tl_compile_const(c, formals));
+  if (c->looped) fputs("tail: ;\n", c->out);
+  tl_compile_copy(c->out, body);
+  fputs("}\n\n", c->out);
+
+  fprintf(c->out, "Value* tl_fn_%i(Env* p, int n, Value** a) {\n", i);
+  fprintf(c->out, "  return tl_c_run(p, tl_fb_%i, n, a);\n", i);
+  fputs("}\n\n", c->out);
+
+  c->self = -1;
+}
+
+static int tl_compile_literal(FILE* out, Value* v, int* n) {
+  int q = (*n)++;
+  switch (v->type) {
+    case TL_INTEGER:
+      if (v->num == LONG_MIN) {
+        fprintf(out, "  Value* q%i = tl_val_num(LONG_MIN);\n", q);
+      } else {
+        fprintf(out, "  Value* q%i = tl_val_num(%ldL);\n", q, v->num);
+      }
+      break;
+
+    case TL_STRING:
+      fprintf(out, "  Value* q%i = tl_val_string(", q);
+      tl_compile_string(out, v->str);
+      fputs(");\n", out);
+      break;
+
+    case TL_ERROR:
+      fprintf(out, "  Value* q%i = tl_val_error(\"%%s\", ", q);
+      tl_compile_string(out, v->err);
+      fputs(");\n", out);
+      break;
+
+    case TL_SYMBOL:
+      fprintf(out, "  Value* q%i = tl_val_symbol(", q);
+      tl_compile_string(out, v->sym);
+      fputs(");\n", out);
+      break;
+
+    // Expansions can hold functions; builtins and lambdas are rebuilt
+    case TL_FUNCTION:
+      if (v->builtin && v->builtin == tl_builtin_find(v->builtin->fn)) {
+        fprintf(out, "  Value* q%i = tl_val_fun(&tl_builtins[%i]);\n", q, (int)(v->builtin - tl_builtins));
+      } else if (!v->builtin && !v->partial && !v->memo) {
+        int f = tl_compile_literal(out, v->formals, n);
+        int b = tl_compile_literal(out, v->body, n);
+        fprintf(out, "  Value* q%i = tl_val_lambda(q%i, q%i);\n", q, f, b);
+        fprintf(out, "  q%i->macro = %i;\n", q, v->macro);
+      } else {
+        fprintf(out, "  Value* q%i = tl_val_error(\"Function cannot be compiled\");\n", q);
+      }
+      break;
+
+    case TL_SEXPR:
+    case TL_QEXPR:
+      fprintf(out, "  Value* q%i = %s;\n", q,
+          v->type == TL_SEXPR ? "tl_val_sexpr()" : "tl_val_qexpr()");
+      for (int i=0; i < v->count; i++) {
+        int x = tl_compile_literal(out, v->cell[i], n);
+        fprintf(out, "  tl_val_add(q%i, q%i);\n", q, x);
+      }
+      break;
+  }
+  return q;
+}
+
+void tl_compile(FILE* out, Value* program) {
+  tl_compiler c;
+  c.out = tmpfile();
+  c.depth = 0;
+  c.temps = 0;
+  c.self = -1;
+  c.looped = 0;
+  c.boxed = 0;
+  c.consts = tl_val_qexpr();
+  c.assigned = tl_val_qexpr();
+  c.macros = tl_val_qexpr();
+  c.count = 0;
+  c.defs = malloc(sizeof(Value*) * (program->count + 1));
+
+  tl_opt_scan(program, c.assigned, c.assigned);
+  tl_compile_macros(program, c.macros);
+
+  // Fold against the builtins a fresh program starts with. Macros are
+  // defined as they are met, so their calls are expanded ahead of time.
+  Env* builtins = tl_env_new();
+  tl_env_add_builtins(builtins);
+  tl_opt_load(program);
+  for (int i=0; i < program->count; i++) {
+    program->cell[i] = tl_opt_fold(builtins, program->cell[i]);
+    Value* form = program->cell[i];
+    if (form->type == TL_SEXPR && form->count == 4 && tl_compile_is(form->cell[0], "defmacro")
+        && !tl_compile_assigned(&c, "defmacro")) {
+      tl_val_delete(tl_val_eval(builtins, tl_val_copy(form)));
+    }
+  }
+  tl_env_delete(builtins);
+
+  for (int i=0; i < program->count; i++) {
+    if (tl_compile_is_def(&c, program->cell[i])) c.defs[c.count++] = program->cell[i];
+  }
+
+  for (int i=0; i < c.count; i++) tl_compile_def(&c, i);
+
+  fputs("int main(void) {\n", c.out);
+  fputs("  Env* e = tl_env_new();\n", c.out);
+  fputs("  tl_env_add_builtins(e);\n", c.out);
+  fputs("  tl_k_init();\n", c.out);
+  for (int i=0; i < program->count; i++) {
+    Value* form = program->cell[i];
+    int def = -1;
+    for (int j=0; j < c.count; j++) if (c.defs[j] == form) def = j;
+
+    c.temps = 0;
+    c.depth = 1;
+    tl_compile_line(&c, "{");
+    c.depth++;
+    if (def >= 0) {
+      for (int j=0; j < c.depth; j++) fputs("  ", c.out);
+      fprintf(c.out, "tl_env_add_builtin(e, tl_fd_%i.name, &tl_fd_%i);\n", def, def);
+    } else {
+      tl_compile_line(&c, "tl_c_print(t%i);", tl_compile_expr(&c, form, NULL, 0));
+    }
+    c.depth--;
+    tl_compile_line(&c, "}");
+  }
+  fputs("  tl_env_delete(e);\n", c.out);
+  fputs("  return 0;\n", c.out);
+  fputs("}\n", c.out);
+
+  fputs(tl_compile_prelude, out);
+  fprintf(out, "static Value* tl_k[%i];\n\n", c.consts->count + 1);
+  fputs("static void tl_k_init(void);\n", out);
+  for (int i=0; i < c.count; i++) {
+    fprintf(out, "Value* tl_fb_%i(Env*, int, Value**);\n", i);
+    fprintf(out, "Value* tl_fn_%i(Env*, int, Value**);\n", i);
+    fprintf(out, "static Builtin tl_fd_%i = { ", i);
+    tl_compile_string(out, c.defs[i]->cell[1]->cell[0]->sym);
+    fprintf(out, ", tl_fn_%i, 0, -1, \"\", 0 };\n", i);
+  }
+  fputs("\n", out);
+
+  // Maps a compiled function to its body, for tail calls through values
+  fputs("tl_builtin tl_c_body(tl_builtin f) {\n", out);
+  for (int i=0; i < c.count; i++) fprintf(out, "  if (f == tl_fn_%i) return tl_fb_%i;\n", i, i);
+  fputs("  return NULL;\n", out);
+  fputs("}\n\n", out);
+
+  tl_compile_copy(out, c.out);
+
+  fputs("\nstatic void tl_k_init(void) {\n", out);
+  int q = 0;
+  for (int i=0; i < c.consts->count; i++) {
+    fputs("  {\n", out);
+    int x = tl_compile_literal(out, c.consts->cell[i], &q);
+    fprintf(out, "  tl_k[%i] = q%i;\n", i, x);
+    fputs("  }\n", out);
+  }
+  fputs("}\n", out);
+
+  free(c.defs);
+  tl_val_delete(c.consts);
+  tl_val_delete(c.assigned);
+  tl_val_delete(c.macros);
+}
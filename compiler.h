@@ -0,0 +1,10 @@
+
+#ifndef COMPILER_H_INCLUDED_
+#define COMPILER_H_INCLUDED_
+
+#include <stdio.h>
+#include "value.h"
+
+void tl_compile(FILE*, Value*);
+
+#endif
@@ -0,0 +1,126 @@
+
+#include "intern.h"
+#include "builtins.h"
+
+// Every canonical node, chained by hash
+static Intern** tl_intern_table = NULL;
+static int tl_intern_size = 0;
+static int tl_intern_count = 0;
+
+static Value* tl_intern_view(Intern* x) {
+  Value* v = malloc(sizeof(Value));
+  v->type = x->type;
+  v->count = x->count;
+  v->cell = x->cell;
+  v->intern = x;
+  v->match = NULL;
+  v->unboxed = 0;
+  return v;
+}
+
+// Shares the node under interned value 'v'
+Value* tl_intern_copy(Value* v) {
+  v->intern->refs++;
+  return tl_intern_view(v->intern);
+}
+
+void tl_intern_release(Intern* x) {
+  if (--x->refs != 0) return;
+
+  Intern** p = &tl_intern_table[x->hash % tl_intern_size];
+  while (*p != x) p = &(*p)->next;
+  *p = x->next;
+  tl_intern_count--;
+
+  for (int i=0; i < x->count; i++) tl_val_delete(x->cell[i]);
+  free(x->cell);
+  free(x);
+}
+
+/* Gives interned value 'v' cells of its own, so it can be changed. The
+ * cells are copies, which for nested interned values is cheap. */
+void tl_intern_unshare(Value* v) {
+  Intern* x = v->intern;
+  v->cell = malloc(sizeof(Value*) * x->count);
+  for (int i=0; i < x->count; i++) v->cell[i] = tl_val_copy(x->cell[i]);
+  v->intern = NULL;
+  tl_intern_release(x);
+}
+
+/* Unshares 'v' and every expression nested in it, for code that rewrites
+ * cells directly rather than through 'tl_val_add' and 'tl_val_pop'. */
+Value* tl_intern_thaw(Value* v) {
+  if (v->type != TL_QEXPR && v->type != TL_SEXPR) return v;
+  if (v->intern) tl_intern_unshare(v);
+  for (int i=0; i < v->count; i++) tl_intern_thaw(v->cell[i]);
+  return v;
+}
+
+// Nested expressions are already canonical, so they compare by node
+static int tl_intern_match(Intern* x, unsigned long h, int type, int n, Value** a) {
+  if (x->hash != h || x->type != type || x->count != n) return 0;
+  for (int i=0; i < n; i++) {
+    Value* y = x->cell[i];
+    if (y->type != a[i]->type) return 0;
+    if (y->type == TL_QEXPR || y->type == TL_SEXPR) {
+      if (y->intern != a[i]->intern) return 0;
+    } else if (!tl_val_eq(y, a[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void tl_intern_grow(void) {
+  int size = tl_intern_size ? tl_intern_size * 2 : 256;
+  Intern** table = calloc(size, sizeof(Intern*));
+  for (int i=0; i < tl_intern_size; i++) {
+    Intern* x = tl_intern_table[i];
+    while (x) {
+      Intern* next = x->next;
+      x->next = table[x->hash % size];
+      table[x->hash % size] = x;
+      x = next;
+    }
+  }
+  free(tl_intern_table);
+  tl_intern_table = table;
+  tl_intern_size = size;
+}
+
+/* Returns the interned form of 'v', which is borrowed. Values other than
+ * Q- and S-expressions are simply copied. */
+Value* tl_intern(Value* v) {
+  if (v->type != TL_QEXPR && v->type != TL_SEXPR) return tl_val_copy(v);
+  if (v->intern) return tl_intern_copy(v);
+  if (tl_intern_count >= tl_intern_size) tl_intern_grow();
+
+  // The hash is the one 'tl_val_hash' gives the expression
+  int n = v->count;
+  Value** cell = malloc(sizeof(Value*) * n);
+  unsigned long h = v->type + 1;
+  for (int i=0; i < n; i++) {
+    cell[i] = tl_intern(v->cell[i]);
+    h = h * 31 + tl_val_hash(cell[i]);
+  }
+
+  for (Intern* x = tl_intern_table[h % tl_intern_size]; x; x = x->next) {
+    if (tl_intern_match(x, h, v->type, n, cell)) {
+      for (int i=0; i < n; i++) tl_val_delete(cell[i]);
+      free(cell);
+      x->refs++;
+      return tl_intern_view(x);
+    }
+  }
+
+  Intern* x = malloc(sizeof(Intern));
+  x->refs = 1;
+  x->hash = h;
+  x->type = v->type;
+  x->count = n;
+  x->cell = cell;
+  x->next = tl_intern_table[h % tl_intern_size];
+  tl_intern_table[h % tl_intern_size] = x;
+  tl_intern_count++;
+  return tl_intern_view(x);
+}
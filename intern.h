@@ -0,0 +1,31 @@
+
+#ifndef INTERN_H_INCLUDED_
+#define INTERN_H_INCLUDED_
+
+#include "value.h"
+
+/* Hash-consed Q- and S-expressions. 'tl_intern' keeps one canonical node
+ * for each structurally distinct expression, with its hash worked out
+ * once. An interned value refers to the node's cells instead of owning
+ * them, so copying it is constant time and two interned values are equal
+ * exactly when they share a node. Nested expressions are interned too.
+ *
+ * Interned values are immutable: the few functions that change a value
+ * in place first give it cells of its own with 'tl_intern_unshare'. */
+
+struct tl_intern {
+  int refs;
+  unsigned long hash;
+  int type;
+  int count;
+  Value** cell;
+  Intern* next;
+};
+
+Value* tl_intern(Value*);
+Value* tl_intern_copy(Value*);
+void   tl_intern_unshare(Value*);
+Value* tl_intern_thaw(Value*);
+void   tl_intern_release(Intern*);
+
+#endif
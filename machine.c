@@ -0,0 +1,669 @@
+
+#include "machine.h"
+#include "builtins.h"
+#include "memo.h"
+#include "macro.h"
+#include "match.h"
+#include "cell.h"
+#include "optimize.h"
+
+enum { TL_STATE_EVAL, TL_STATE_APPLY, TL_STATE_RETURN, TL_STATE_BODY };
+
+static Machine* tl_machine_current = NULL;
+static long tl_machine_ids = 0;
+
+static Builtin tl_machine_k = { "continuation", builtin_continue, 0, 1, "", 0 };
+
+Machine* tl_machine_new(void) {
+  Machine* m = malloc(sizeof(Machine));
+  m->refs = 1;
+  m->depth = 0;
+  m->count = 0;
+  m->size = 16;
+  m->frames = malloc(sizeof(Frame) * m->size);
+  m->stack = NULL;
+  m->root = NULL;
+  m->start = NULL;
+  m->running = 0;
+  m->yielded = 0;
+  m->done = 0;
+  return m;
+}
+
+static Value** tl_machine_reserve(Machine* m, int n) {
+  Stack* s = m->stack;
+  if (!s || s->top + n > s->size) {
+    s = malloc(sizeof(Stack));
+    s->prev = m->stack;
+    s->size = n > 256 ? n : 256;
+    s->top = 0;
+    s->slots = malloc(sizeof(Value*) * s->size);
+    m->stack = s;
+  }
+
+  s->top += n;
+  return &s->slots[s->top - n];
+}
+
+static void tl_machine_unreserve(Machine* m, int n) {
+  Stack* s = m->stack;
+  s->top -= n;
+  if (s->top == 0 && s->prev) {
+    m->stack = s->prev;
+    free(s->slots);
+    free(s);
+  }
+}
+
+static Frame* tl_machine_push(Machine* m, int kind, Env* e) {
+  if (m->count == m->size) {
+    m->size *= 2;
+    m->frames = realloc(m->frames, sizeof(Frame) * m->size);
+  }
+
+  Frame* f = &m->frames[m->count++];
+  f->kind = kind;
+  f->env = e;
+  f->expr = NULL;
+  f->argv = NULL;
+  f->argc = 0;
+  f->size = 0;
+  f->borrowed = 0;
+  f->atoms = 0;
+  f->pure = 0;
+  f->fn = NULL;
+  f->id = 0;
+  return f;
+}
+
+static Frame* tl_machine_args(Machine* m, Env* e, int n) {
+  Frame* f = tl_machine_push(m, TL_FRAME_ARGS, e);
+  f->argv = tl_machine_reserve(m, n);
+  f->size = n;
+  return f;
+}
+
+static int tl_machine_borrowed(Frame* f, int i) {
+  return i < 64 && (f->borrowed >> i) & 1;
+}
+
+static void tl_machine_store(Frame* f, Value* v, int owned) {
+  int i = f->argc++;
+  if (!owned) {
+    if (i < 64) f->borrowed |= 1ULL << i; else v = tl_val_copy(v);
+  }
+  f->argv[i] = v;
+}
+
+// Returns argument 'i' as a value the caller owns
+static Value* tl_machine_take(Frame* f, int i) {
+  Value* v = f->argv[i];
+  if (tl_machine_borrowed(f, i)) return tl_val_copy(v);
+  f->argv[i] = NULL;
+  return v;
+}
+
+static int tl_machine_formals(Value* v) {
+  if (v->type != TL_QEXPR) return 0;
+  for (int i=0; i < v->count; i++) {
+    if (v->cell[i]->type != TL_SYMBOL) return 0;
+  }
+  return 1;
+}
+
+/* Whether frame 'f' stops error 'err' unwinding: a 'try' handles any
+ * error but the escape to a continuation, which only its 'call/cc'
+ * frame handles. */
+static int tl_machine_handles(Frame* f, Value* err) {
+  return (f->kind == TL_FRAME_TRY && err->num == 0)
+    || (f->kind == TL_FRAME_CATCH && err->num == f->id);
+}
+
+static void tl_machine_pop(Machine* m) {
+  Frame* f = &m->frames[--m->count];
+
+  for (int i=0; i < f->argc; i++) {
+    if (f->argv[i] && !tl_machine_borrowed(f, i)) tl_val_delete(f->argv[i]);
+  }
+  if (f->size) tl_machine_unreserve(m, f->size);
+  if (f->fn) tl_val_delete(f->fn);
+  if (f->kind == TL_FRAME_SCOPE) tl_env_delete(f->env);
+}
+
+void tl_machine_release(Machine* m) {
+  if (--m->refs > 0) return;
+
+  while (m->count) tl_machine_pop(m);
+  while (m->stack) {
+    Stack* s = m->stack;
+    m->stack = s->prev;
+    free(s->slots);
+    free(s);
+  }
+  free(m->frames);
+  if (m->root) tl_env_delete(m->root);
+  if (m->start) tl_val_delete(m->start);
+  free(m);
+}
+
+/* Runs until the stack is back down to 'base' frames. Frames below
+ * 'base' belong to an enclosing run that is waiting in C code.
+ *
+ * Code is never copied: 'v' in TL_STATE_EVAL points into an expression
+ * owned by a frame further down, and literals are passed on borrowed.
+ * Symbols are borrowed too when the call is to a pure builtin and none
+ * of its arguments can run code before it does. */
+static Value* tl_machine_run(Machine* m, int base, int state, Env* e, Value* v) {
+  int owned = 1;
+  int body = state == TL_STATE_BODY;
+  if (body) state = TL_STATE_EVAL;
+  m->depth++;
+
+  while (1) {
+    if (state == TL_STATE_EVAL) {
+      state = TL_STATE_RETURN;
+      owned = 0;
+
+      if (v->type == TL_SYMBOL) {
+        if (tl_cell_current) tl_cell_read(v);
+        Value* x = tl_env_lookup(e, v);
+        if (!x) {
+          v = tl_val_error("Unbound symbol '%s'", v->sym);
+          owned = 1;
+          continue;
+        }
+
+        // Arguments of a pure builtin, an 'if' condition and the value
+        // of a 'match' are only looked at, never kept
+        Frame* f = m->count > base ? &m->frames[m->count-1] : NULL;
+        if (!(f && f->kind == TL_FRAME_ARGS && f->pure)
+            && !(f && (f->kind == TL_FRAME_IF || f->kind == TL_FRAME_MATCH))) {
+          x = tl_val_copy(x);
+          owned = 1;
+        }
+        v = x;
+        continue;
+      }
+
+      // Q-expressions are only code as the body of a lambda or branch
+      if (v->type != TL_SEXPR && !(body && v->type == TL_QEXPR)) continue;
+      body = 0;
+
+      if (v->count == 0) {
+        v = tl_val_sexpr();
+        owned = 1;
+        continue;
+      }
+
+      // Reads of cells are recorded one by one, so they stay boxed
+      long n;
+      if (v->unboxed && !tl_cell_current && tl_opt_unboxed(e, v, &n)) {
+        v = tl_val_num(n);
+        owned = 1;
+        continue;
+      }
+
+      if (v->count == 1) {
+        v = v->cell[0];
+        state = TL_STATE_EVAL;
+        continue;
+      }
+
+      Value* x = v->cell[0]->type == TL_SYMBOL ? tl_env_lookup(e, v->cell[0]) : NULL;
+      tl_builtin fn = x && x->type == TL_FUNCTION && x->builtin ? x->builtin->fn : NULL;
+
+      // A macro call not expanded ahead of time is expanded into its own
+      // node, so it is only expanded once: the body of a lambda is shared
+      // by the copies made to call it. Interned nodes cannot be changed.
+      if (x && tl_macro_is(x)) {
+        Value* code = tl_macro_expand(e, x, v);
+        if (code->type == TL_ERROR) {
+          v = code;
+          owned = 1;
+          continue;
+        }
+        if (v->intern) {
+          tl_machine_push(m, TL_FRAME_OWN, e)->fn = code;
+          v = code;
+        } else {
+          tl_macro_replace(v, code);
+          body = v->type == TL_QEXPR;
+        }
+        state = TL_STATE_EVAL;
+        continue;
+      }
+
+      // Special forms work on their operands as code, so nothing is
+      // evaluated or copied that the form does not need
+      if (fn == builtin_quote && v->count == 2) {
+        v = v->cell[1];
+        continue;
+      }
+
+      if (fn == builtin_if && v->count == 4
+          && v->cell[2]->type == TL_QEXPR && v->cell[3]->type == TL_QEXPR) {
+        tl_machine_push(m, TL_FRAME_IF, e)->expr = v;
+        v = v->cell[1];
+        state = TL_STATE_EVAL;
+        continue;
+      }
+
+      if (fn == builtin_try && v->count == 4 && v->cell[1]->type == TL_QEXPR
+          && tl_machine_formals(v->cell[2]) && v->cell[2]->count == 1
+          && v->cell[3]->type == TL_QEXPR) {
+        tl_machine_push(m, TL_FRAME_TRY, e)->expr = v;
+        v = v->cell[1];
+        body = 1;
+        state = TL_STATE_EVAL;
+        continue;
+      }
+
+      // The decision tree is normally built with the lambda; a form the
+      // optimizer has not seen gets one on its first evaluation
+      if (fn == builtin_match) {
+        Value* err = v->match ? NULL : tl_match_compile(v);
+        if (err) {
+          v = err;
+          owned = 1;
+          continue;
+        }
+        tl_machine_push(m, TL_FRAME_MATCH, e)->expr = v;
+        v = v->cell[1];
+        state = TL_STATE_EVAL;
+        continue;
+      }
+
+      // Folded as 'builtin_lambda' folds it, expanding its macro calls
+      if (fn == builtin_lambda && v->count == 3 && tl_machine_formals(v->cell[1])
+          && v->cell[2]->type == TL_QEXPR) {
+        v = builtin_lambda(e, 2, v->cell + 1);
+        owned = 1;
+        continue;
+      }
+
+      Frame* f = tl_machine_args(m, e, v->count);
+      f->expr = v;
+      f->atoms = 1;
+      for (int i=1; i < v->count; i++) {
+        if (v->cell[i]->type == TL_SEXPR) f->atoms = 0;
+      }
+
+      state = TL_STATE_EVAL;
+      if (!x) {
+        v = v->cell[0];
+        continue;
+      }
+
+      // The head is already looked up. A builtin can stay borrowed when
+      // no argument can run code that rebinds it before the call.
+      if (fn && f->atoms) {
+        f->pure = x->builtin->flags & TL_PURE;
+        tl_machine_store(f, x, 0);
+      } else {
+        tl_machine_store(f, tl_val_copy(x), 1);
+      }
+      v = v->cell[1];
+      continue;
+    }
+
+    if (state == TL_STATE_APPLY) {
+      // Apply argv[0] of the top frame to the rest of its arguments
+      Frame* f = &m->frames[m->count-1];
+      Value* fn = f->argv[0];
+      Value** a = f->argv + 1;
+      int n = f->argc - 1;
+      e = f->env;
+      state = TL_STATE_RETURN;
+      owned = 1;
+
+      if (fn->type != TL_FUNCTION) {
+        v = tl_val_error(
+            "S-expression starts with incorrect type. "
+            "Got %s, expected %s.",
+            tl_type_name(fn->type), tl_type_name(TL_FUNCTION));
+        tl_machine_pop(m);
+        continue;
+      }
+
+      // On a miss the frame stays as a marker to store the result at, and
+      // the wrapped function is called above it like any other
+      if (fn->memo) {
+        v = tl_memo_lookup(fn->memo, n, a);
+        if (v) {
+          tl_machine_pop(m);
+          continue;
+        }
+        Value** key = f->argv;
+        f->kind = TL_FRAME_MEMO;
+        f = tl_machine_args(m, e, n+1);
+        tl_machine_store(f, fn->memo->fn, 0);
+        for (int i=0; i < n; i++) tl_machine_store(f, key[i+1], 0);
+        state = TL_STATE_APPLY;
+        continue;
+      }
+
+      if (fn->builtin) {
+        Builtin* b = fn->builtin;
+        Value* err = tl_builtin_check(b, n, a);
+        if (err) {
+          v = err;
+          tl_machine_pop(m);
+          continue;
+        }
+
+        if (b->fn == builtin_if || b->fn == builtin_eval) {
+          int i = b->fn == builtin_eval ? 1 : a[0]->num ? 2 : 3;
+          if (tl_machine_borrowed(f, i)) {
+            v = f->argv[i];
+            tl_machine_pop(m);
+          } else {
+            v = tl_machine_take(f, i);
+            tl_machine_pop(m);
+            tl_machine_push(m, TL_FRAME_OWN, e)->fn = v;
+          }
+          body = 1;
+          state = TL_STATE_EVAL;
+          continue;
+        }
+
+        if (b->fn == builtin_def || b->fn == builtin_put) {
+          // The values are moved into the environment, not copied
+          for (int i=2; i < f->argc; i++) {
+            if (tl_machine_borrowed(f, i)) {
+              f->argv[i] = tl_val_copy(f->argv[i]);
+              f->borrowed &= ~(1ULL << i);
+            }
+          }
+          v = builtin_var(e, n, a, b->name, 1);
+          tl_machine_pop(m);
+          continue;
+        }
+
+        if (b == &tl_machine_k) {
+          v = tl_val_error("Continuation invoked outside of its extent");
+          v->num = fn->num;
+          v->body = n ? tl_machine_take(f, 1) : tl_val_sexpr();
+          tl_machine_pop(m);
+          continue;
+        }
+
+        if (b->fn == builtin_callcc) {
+          Value* g = tl_machine_take(f, 1);
+          tl_machine_pop(m);
+
+          long id = ++tl_machine_ids;
+          tl_machine_push(m, TL_FRAME_CATCH, e)->id = id;
+
+          Value* k = tl_val_fun(&tl_machine_k);
+          k->num = id;
+          f = tl_machine_args(m, e, 2);
+          tl_machine_store(f, g, 1);
+          tl_machine_store(f, k, 1);
+          state = TL_STATE_APPLY;
+          continue;
+        }
+
+        if (b->fn == builtin_yield) {
+          if (m->root && m->depth == 1) {
+            v = n ? tl_machine_take(f, 1) : tl_val_sexpr();
+            tl_machine_pop(m);
+            m->yielded = 1;
+            m->depth--;
+            return v;
+          }
+          v = m->root
+            ? tl_val_error("Function 'yield' called inside a nested builtin call, which is not supported")
+            : tl_val_error("Function 'yield' called outside of a generator");
+          tl_machine_pop(m);
+          continue;
+        }
+
+        // The builtin may run nested evaluations, which can move the
+        // frame array but leave the argument vector where it is
+        v = b->fn(e, n, a);
+        tl_machine_pop(m);
+        continue;
+      }
+
+      // Binding moves the arguments into the lambda's environment
+      fn = tl_machine_take(f, 0);
+      for (int i=1; i < f->argc; i++) {
+        if (tl_machine_borrowed(f, i)) {
+          f->argv[i] = tl_val_copy(f->argv[i]);
+          f->borrowed &= ~(1ULL << i);
+        }
+      }
+
+      // Too few arguments: the lambda is shared by a partial application,
+      // and only copied once the rest arrive and it is really called.
+      if (n < tl_val_arity(fn)) {
+        v = n ? tl_val_partial(fn, n, a) : fn;
+        tl_machine_pop(m);
+        continue;
+      }
+      if (fn->partial) {
+        Value* x = tl_val_unpartial(fn);
+        tl_val_delete(fn);
+        fn = x;
+      }
+
+      Value* err = tl_val_bind(e, fn, n, a);
+      tl_machine_pop(m);
+      if (err) {
+        tl_val_delete(fn);
+        v = err;
+        continue;
+      }
+
+      // A call whose result goes straight to the enclosing lambda's frame
+      // is in tail position and replaces it, along with the scopes of any
+      // 'match' clauses it is in. Scope is dynamic, so the callee takes
+      // over the bindings of what it replaces that its own do not shadow,
+      // and still sees everything its caller did.
+      Frame* top = m->count > base ? &m->frames[m->count-1] : NULL;
+      while (top && top->kind == TL_FRAME_SCOPE && top->env == e) {
+        tl_env_merge(fn->env, e);
+        e = e->parent;
+        tl_machine_pop(m);
+        top = m->count > base ? &m->frames[m->count-1] : NULL;
+      }
+      if (top && top->kind == TL_FRAME_CALL && top->env == e) {
+        tl_env_merge(fn->env, e);
+        fn->env->parent = e->parent;
+        tl_val_delete(top->fn);
+        top->fn = fn;
+        top->env = fn->env;
+      } else {
+        fn->env->parent = e;
+        tl_machine_push(m, TL_FRAME_CALL, fn->env)->fn = fn;
+      }
+
+      e = fn->env;
+      v = fn->body;
+      body = 1;
+      state = TL_STATE_EVAL;
+      continue;
+    }
+
+    // TL_STATE_RETURN: deliver value 'v' to the top frame
+    Frame* f = m->count > base ? &m->frames[m->count-1] : NULL;
+
+    if (f && f->kind == TL_FRAME_IF && v->type == TL_INTEGER) {
+      // Continue with the chosen branch in place, in tail position
+      Value* x = f->expr->cell[v->num ? 2 : 3];
+      if (owned) tl_val_delete(v);
+      e = f->env;
+      tl_machine_pop(m);
+      v = x;
+      body = 1;
+      state = TL_STATE_EVAL;
+      continue;
+    }
+
+    if (f && f->kind == TL_FRAME_MATCH && v->type != TL_ERROR) {
+      // Continue with the body of the first clause that matches, in a
+      // scope of its own for the pattern's variables
+      MatchNode* leaf = tl_match_find(f->expr->match, v);
+      if (leaf) {
+        e = tl_env_new();
+        e->parent = f->env;
+        tl_match_bind(leaf, v, e);
+        if (owned) tl_val_delete(v);
+        v = f->expr->cell[3 + 2 * leaf->clause];
+        tl_machine_pop(m);
+        tl_machine_push(m, TL_FRAME_SCOPE, e);
+        body = 1;
+        state = TL_STATE_EVAL;
+        continue;
+      }
+      Value* err = tl_val_error("Function 'match' found no pattern matching %s",
+        tl_type_name(v->type));
+      if (owned) tl_val_delete(v);
+      v = err;
+      owned = 1;
+    }
+
+    if (f && f->kind == TL_FRAME_ARGS && v->type != TL_ERROR) {
+      tl_machine_store(f, v, owned);
+      e = f->env;
+      if (f->argc < f->size) {
+        v = f->expr->cell[f->argc];
+        state = TL_STATE_EVAL;
+      } else {
+        state = TL_STATE_APPLY;
+      }
+      continue;
+    }
+
+    // Anything borrowed must be copied before its owner is popped
+    if (!owned) {
+      v = tl_val_copy(v);
+      owned = 1;
+    }
+
+    if (!f) {
+      m->depth--;
+      return v;
+    }
+
+    if (f->kind == TL_FRAME_IF && v->type != TL_ERROR) {
+      Value* a[3] = { v, f->expr->cell[2], f->expr->cell[3] };
+      Value* err = tl_builtin_check(tl_builtin_find(builtin_if), 3, a);
+      tl_val_delete(v);
+      v = err;
+    }
+
+    // An error unwinds straight to the frame that handles it, releasing
+    // every frame above, or to the caller of this run
+    if (v->type == TL_ERROR && !tl_machine_handles(f, v)) {
+      while (m->count > base && !tl_machine_handles(&m->frames[m->count-1], v)) {
+        tl_machine_pop(m);
+      }
+      if (m->count == base) {
+        m->depth--;
+        return v;
+      }
+      f = &m->frames[m->count-1];
+    }
+
+    if (f->kind == TL_FRAME_TRY && v->type == TL_ERROR) {
+      // Continue with the handler in place, in tail position, with the
+      // message bound to its variable
+      Value* x = f->expr->cell[3];
+      tl_env_set(f->env, f->expr->cell[2]->cell[0], tl_val_string(v->err));
+      tl_val_delete(v);
+      e = f->env;
+      tl_machine_pop(m);
+      v = x;
+      body = 1;
+      state = TL_STATE_EVAL;
+      continue;
+    }
+
+    if (f->kind == TL_FRAME_MEMO) {
+      tl_memo_store(f->argv[0]->memo, f->argc - 1, f->argv + 1, v);
+    }
+
+    if (f->kind == TL_FRAME_CATCH && v->type == TL_ERROR && v->num == f->id) {
+      Value* x = v->body;
+      v->body = NULL;
+      tl_val_delete(v);
+      v = x;
+    }
+    tl_machine_pop(m);
+  }
+}
+
+static Machine* tl_machine_get(void) {
+  if (!tl_machine_current) tl_machine_current = tl_machine_new();
+  return tl_machine_current;
+}
+
+Value* tl_machine_eval(Env* e, Value* v) {
+  Machine* m = tl_machine_get();
+  int base = m->count;
+  tl_machine_push(m, TL_FRAME_OWN, e)->fn = v;
+  return tl_machine_run(m, base, TL_STATE_EVAL, e, v);
+}
+
+/* Evaluates 'body' as code, in place. It stays with the caller, so a
+ * loop can run the same body again without copying it. */
+Value* tl_machine_body(Env* e, Value* body) {
+  Machine* m = tl_machine_get();
+  return tl_machine_run(m, m->count, TL_STATE_BODY, e, body);
+}
+
+/* Applies 'fn' to 'n' arguments, all of which stay with the caller. */
+Value* tl_machine_apply(Env* e, Value* fn, int n, Value** a) {
+  Machine* m = tl_machine_get();
+  int base = m->count;
+
+  Frame* f = tl_machine_args(m, e, n+1);
+  tl_machine_store(f, fn, 0);
+  for (int i=0; i < n; i++) tl_machine_store(f, a[i], 0);
+  return tl_machine_run(m, base, TL_STATE_APPLY, e, NULL);
+}
+
+/* Runs a generator until its next 'yield'. Returns {value} for a yielded
+ * value and {} once the generator has finished. */
+Value* tl_machine_resume(Machine* m, Env* e) {
+  if (m->done) return tl_val_qexpr();
+  if (m->running) return tl_val_error("Generator is already running");
+
+  Machine* prev = tl_machine_current;
+  tl_machine_current = m;
+  m->running = 1;
+
+  // Frames at the bottom of the generator refer to its root environment,
+  // which is reattached to wherever it is being resumed from.
+  if (!m->root) m->root = tl_env_new();
+  m->root->parent = e;
+
+  Value* v;
+  if (m->start) {
+    Value* a = m->start;
+    m->start = NULL;
+
+    Frame* f = tl_machine_args(m, m->root, a->count);
+    for (int i=0; i < a->count; i++) tl_machine_store(f, a->cell[i], 1);
+    free(a->cell);
+    free(a);
+    v = tl_machine_run(m, 0, TL_STATE_APPLY, m->root, NULL);
+  } else {
+    v = tl_machine_run(m, 0, TL_STATE_RETURN, m->root, tl_val_sexpr());
+  }
+
+  tl_machine_current = prev;
+  m->running = 0;
+
+  if (m->yielded) {
+    m->yielded = 0;
+    return tl_val_add(tl_val_qexpr(), v);
+  }
+
+  m->done = 1;
+  if (v->type == TL_ERROR) return v;
+
+  tl_val_delete(v);
+  return tl_val_qexpr();
+}
@@ -0,0 +1,81 @@
+
+#ifndef MACHINE_H_INCLUDED_
+#define MACHINE_H_INCLUDED_
+
+#include "value.h"
+
+/* The evaluator keeps its control state in an explicit stack of frames
+ * rather than on the C stack. Each generator owns a machine of its own
+ * so it can be suspended at a 'yield' and resumed later. */
+
+enum { TL_FRAME_ARGS, TL_FRAME_CALL, TL_FRAME_CATCH, TL_FRAME_OWN, TL_FRAME_IF,
+       TL_FRAME_MATCH, TL_FRAME_TRY, TL_FRAME_MEMO, TL_FRAME_SCOPE };
+
+typedef struct {
+  int kind;
+
+  // TL_FRAME_SCOPE: owns 'env', the variables of a 'match' clause
+  Env* env;
+
+  // TL_FRAME_IF: 'expr' is an 'if' whose condition is being evaluated
+  // TL_FRAME_MATCH: 'expr' is a 'match' whose value is being evaluated
+  // TL_FRAME_TRY: 'expr' is a 'try' whose body is being evaluated
+  // TL_FRAME_ARGS: elements of 'expr' are evaluated one at a time into
+  // 'argv', which has room for 'size' values. Bit i of 'borrowed' is set
+  // when argv[i] belongs to the code or an environment, not the frame.
+  // TL_FRAME_MEMO: 'argv' holds a memoised function and the arguments
+  // whose result it keeps once the call returns to this frame.
+  Value* expr;
+  Value** argv;
+  int argc;
+  int size;
+  unsigned long long borrowed;
+  int atoms;
+  int pure;
+
+  // TL_FRAME_CALL: lambda whose environment is the current frame
+  // TL_FRAME_OWN: code being evaluated that nothing else owns
+  Value* fn;
+
+  // TL_FRAME_CATCH: continuation marker for call/cc
+  long id;
+} Frame;
+
+/* Argument vectors are carved out of fixed-size chunks, so a vector
+ * handed to a builtin stays where it is while nested calls push more. */
+typedef struct tl_stack {
+  struct tl_stack* prev;
+  int size;
+  int top;
+  Value** slots;
+} Stack;
+
+struct tl_machine {
+  int refs;
+  int depth;
+  int count;
+  int size;
+  Frame* frames;
+  Stack* stack;
+
+  // Generators only
+  Env* root;
+  Value* start;
+  int running;
+  int yielded;
+  int done;
+};
+
+Value* tl_machine_eval(Env*, Value*);
+Value* tl_machine_body(Env*, Value*);
+Value* tl_machine_apply(Env*, Value*, int, Value**);
+
+/* A generator can only be suspended from its own run of the machine, not
+ * from one a builtin started to call back into Lisp, as the builtin's C
+ * frame cannot be kept. So 'yield' inside a function passed to 'map',
+ * 'filter', 'foldl' and the like is an error rather than a suspension. */
+Machine* tl_machine_new(void);
+void     tl_machine_release(Machine*);
+Value*   tl_machine_resume(Machine*, Env*);
+
+#endif
@@ -0,0 +1,107 @@
+
+#include <stdio.h>
+
+#include "macro.h"
+#include "builtins.h"
+#include "intern.h"
+#include "match.h"
+
+static long tl_macro_names = 0;
+
+int tl_macro_is(Value* v) {
+  return v->type == TL_FUNCTION && !v->builtin && !v->partial && !v->memo && v->macro;
+}
+
+/* Symbols carry a mark in 'num' while an expansion is worked out: set on
+ * those that came from the operands, clear on those from the macro. */
+static void tl_macro_mark(Value* v, int mark) {
+  if (v->type == TL_SYMBOL) v->num = mark;
+  if (v->type != TL_SEXPR && v->type != TL_QEXPR) return;
+  for (int i=0; i < v->count; i++) tl_macro_mark(v->cell[i], mark);
+}
+
+static int tl_macro_binder(Value* v) {
+  if (v->count < 2 || v->cell[1]->type != TL_QEXPR) return 0;
+  Value* h = v->cell[0];
+
+  // An expansion built with 'list' may hold the builtin itself
+  if (h->type == TL_FUNCTION && h->builtin) {
+    tl_builtin f = h->builtin->fn;
+    return f == builtin_lambda || f == builtin_for || f == builtin_each;
+  }
+  if (h->type != TL_SYMBOL) return 0;
+  return strcmp(h->sym, "\\") == 0 || strcmp(h->sym, "for") == 0 || strcmp(h->sym, "each") == 0;
+}
+
+// Renames the macro's own occurrences of 'from' in 'v' to 'to'
+static void tl_macro_rename(Value* v, char* from, char* to) {
+  if (v->type == TL_SYMBOL && !v->num && strcmp(v->sym, from) == 0) {
+    free(v->sym);
+    v->sym = malloc(strlen(to) + 1);
+    strcpy(v->sym, to);
+  }
+  if (v->type != TL_SEXPR && v->type != TL_QEXPR) return;
+  for (int i=0; i < v->count; i++) tl_macro_rename(v->cell[i], from, to);
+}
+
+static void tl_macro_hygiene(Value* v) {
+  if (v->type != TL_SEXPR && v->type != TL_QEXPR) return;
+
+  if (tl_macro_binder(v)) {
+    Value* syms = v->cell[1];
+    for (int i=0; i < syms->count; i++) {
+      Value* s = syms->cell[i];
+      if (s->type != TL_SYMBOL || s->num || strcmp(s->sym, "&") == 0) continue;
+
+      // '#' cannot appear in a symbol that is read
+      char* from = malloc(strlen(s->sym) + 1);
+      strcpy(from, s->sym);
+      char* to = malloc(strlen(from) + 24);
+      sprintf(to, "%s#%ld", from, ++tl_macro_names);
+      tl_macro_rename(v, from, to);
+      free(from);
+      free(to);
+    }
+  }
+
+  for (int i=0; i < v->count; i++) tl_macro_hygiene(v->cell[i]);
+}
+
+/* Applies 'macro' to the operands of call 'form', which is borrowed, and
+ * returns the expansion as an S-expression, or an error. */
+Value* tl_macro_expand(Env* e, Value* macro, Value* form) {
+  int n = form->count - 1;
+  Value** a = malloc(sizeof(Value*) * (n + 1));
+  for (int i=0; i < n; i++) {
+    a[i] = tl_intern_thaw(tl_val_copy(form->cell[i+1]));
+    tl_macro_mark(a[i], 1);
+  }
+
+  Value* x = tl_val_call(e, macro, n, a);
+  for (int i=0; i < n; i++) tl_val_delete(a[i]);
+  free(a);
+  if (x->type == TL_ERROR) return x;
+
+  tl_intern_thaw(x);
+  if (x->type == TL_QEXPR) {
+    x->type = TL_SEXPR;
+  } else if (x->type != TL_SEXPR) {
+    x = tl_val_add(tl_val_sexpr(), x);
+  }
+  tl_macro_hygiene(x);
+  tl_macro_mark(x, 0);
+  return x;
+}
+
+/* Puts expansion 'code' in place of the cells of call 'form', keeping
+ * the type of 'form', which may be a lambda body. */
+void tl_macro_replace(Value* form, Value* code) {
+  if (form->match) tl_match_release(form->match);
+  form->match = code->match;
+  form->unboxed = code->unboxed;
+  for (int i=0; i < form->count; i++) tl_val_delete(form->cell[i]);
+  free(form->cell);
+  form->count = code->count;
+  form->cell = code->cell;
+  free(code);
+}
@@ -0,0 +1,23 @@
+
+#ifndef MACRO_H_INCLUDED_
+#define MACRO_H_INCLUDED_
+
+#include "value.h"
+
+/* A macro is a lambda with 'macro' set. It is applied to the operands of a
+ * call as they are written, as 'quote' would give them, and returns the
+ * code that runs in place of the call. The expansion is done once: when
+ * the optimizer folds the form or the lambda body holding the call, or
+ * failing that the first time the call is evaluated, after which it is
+ * kept in the call's node, which copies of a lambda share.
+ *
+ * Expansions are hygienic for the names they bind: a formal of a lambda
+ * or the variable of a 'for' or 'each' that the macro itself introduced,
+ * rather than took from its operands, is renamed to a name no program
+ * can spell, so it can neither capture nor be captured by the caller's. */
+
+int    tl_macro_is(Value*);
+Value* tl_macro_expand(Env*, Value*, Value*);
+void   tl_macro_replace(Value*, Value*);
+
+#endif
@@ -1,37 +1,60 @@
 #include <stdio.h>
 #include <editline/readline.h>
 
-#include "mpc.h"
 #include "value.h"
+#include "reader.h"
+#include "compiler.h"
+#include "optimize.h"
+
+void tl_load(Env* e, Value* program) {
+  tl_opt_load(program);
+  while (program->count) {
+    Value* x = tl_val_eval(e, tl_opt_fold(e, tl_val_pop(program, 0)));
+    if (x->type != TL_SEXPR || x->count != 0) {
+      tl_val_print(x);
+      puts("");
+    }
+    tl_val_delete(x);
+  }
+  tl_val_delete(program);
+}
 
 int main(int argc, char** argv) {
 
-  mpc_parser_t* Number   = mpc_new("number");
-  mpc_parser_t* Symbol   = mpc_new("symbol");
-  mpc_parser_t* String   = mpc_new("string");
-  mpc_parser_t* Comment  = mpc_new("comment");
-  mpc_parser_t* Sexpr    = mpc_new("sexpr");
-  mpc_parser_t* Qexpr    = mpc_new("qexpr");
-  mpc_parser_t* Expr     = mpc_new("expr");
-  mpc_parser_t* Tinylisp = mpc_new("tinylisp");
-
-  printf("1");
-
-  mpca_lang(MPCA_LANG_DEFAULT,
-    " \
-      number   : /-?[0-9]+/ ;                               \
-      symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;         \
-      string   : /\"(\\\\.|[^\"])*\"/ ;                     \
-      comment  : /;[^\\r\\n]*/ ;                            \
-      sexpr    : '(' <expr>* ')' ;                          \
-      qexpr    : '{' <expr>* '}' ;                          \
-      expr     : <number>  | <symbol> | <string>            \
-               | <comment> | <sexpr>  | <qexpr> ;           \
-      tinylisp : /^/ <expr>* /$/ ;                          \
-    ",
-    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Tinylisp);
-
-  mpc_result_t r;
+  if (argc == 3 && strcmp(argv[1], "--emit-c") == 0) {
+    Value* program = tl_read_file(argv[2]);
+    if (program->type == TL_ERROR) {
+      puts(program->err);
+      tl_val_delete(program);
+      return 1;
+    }
+
+    tl_compile(stdout, program);
+    tl_val_delete(program);
+    return 0;
+  }
+
+  if (argc >= 2) {
+    Env* e = tl_env_new();
+    tl_env_add_builtins(e);
+
+    for (int i=1; i < argc; i++) {
+      if (strncmp(argv[i], "--inline=", 9) == 0) {
+        tl_opt_inline_size = atoi(argv[i] + 9);
+        continue;
+      }
+      Value* program = tl_read_file(argv[i]);
+      if (program->type != TL_ERROR) {
+        tl_load(e, program);
+      } else {
+        puts(program->err);
+        tl_val_delete(program);
+      }
+    }
+
+    tl_env_delete(e);
+    return 0;
+  }
 
   puts("Tinylisp Version 0.0.1");
   puts("Press Ctrl+c to Exit\n");
@@ -45,23 +68,21 @@ int main(int argc, char** argv) {
 
     if (strcmp(input, "exit") == 0) return 0;
 
-    if (mpc_parse("<stdin>", input, Tinylisp, &r)) {
-      Value* x = tl_val_eval(e, tl_val_read(r.output));
+    Value* x = tl_read("<stdin>", input);
+    if (x->type != TL_ERROR) {
+      tl_opt_load(x);
+      for (int i=0; i < x->count; i++) x->cell[i] = tl_opt_fold(e, x->cell[i]);
+      x = tl_val_eval(e, x);
       tl_val_print(x);
       puts("");
-      tl_val_delete(x);
-
-      mpc_ast_delete(r.output);
     } else {
-      mpc_err_print(r.error);
-      mpc_err_delete(r.error);
+      puts(x->err);
     }
+    tl_val_delete(x);
 
     free(input);
   }
 
-  mpc_cleanup(7, Number, Symbol, String, Comment, Sexpr, Expr, Tinylisp);
-
   return 0;
 }
 
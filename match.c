@@ -0,0 +1,227 @@
+
+#include "match.h"
+#include "builtins.h"
+
+static MatchNode* tl_match_node(int kind, int depth, int* path) {
+  MatchNode* n = calloc(1, sizeof(MatchNode));
+  n->kind = kind;
+  n->depth = depth;
+  n->path = malloc(sizeof(int) * (depth + 1));
+  if (depth) memcpy(n->path, path, sizeof(int) * depth);
+  return n;
+}
+
+static void tl_match_free(MatchNode* n) {
+  for (int i=0; i < n->children; i++) tl_match_free(n->child[i]);
+  for (int i=0; i < n->binds; i++) {
+    tl_val_delete(n->names[i]);
+    free(n->paths[i]);
+  }
+  if (n->literal) tl_val_delete(n->literal);
+  free(n->names);
+  free(n->depths);
+  free(n->paths);
+  free(n->rests);
+  free(n->child);
+  free(n->path);
+  free(n);
+}
+
+void tl_match_release(Match* m) {
+  if (--m->refs != 0) return;
+  tl_match_free(m->root);
+  free(m);
+}
+
+static void tl_match_add(MatchNode* n, MatchNode* child) {
+  n->children++;
+  n->child = realloc(n->child, sizeof(MatchNode*) * n->children);
+  n->child[n->children - 1] = child;
+}
+
+static void tl_match_binding(MatchNode* leaf, Value* name, int depth, int* path, int rest) {
+  int i = leaf->binds++;
+  leaf->names = realloc(leaf->names, sizeof(Value*) * leaf->binds);
+  leaf->depths = realloc(leaf->depths, sizeof(int) * leaf->binds);
+  leaf->paths = realloc(leaf->paths, sizeof(int*) * leaf->binds);
+  leaf->rests = realloc(leaf->rests, sizeof(int) * leaf->binds);
+  leaf->names[i] = tl_val_copy(name);
+  leaf->depths[i] = depth;
+  leaf->paths[i] = malloc(sizeof(int) * (depth + 1));
+  if (depth) memcpy(leaf->paths[i], path, sizeof(int) * depth);
+  leaf->rests[i] = rest;
+}
+
+static int tl_match_is(Value* v, char* s) {
+  return v->type == TL_SYMBOL && strcmp(v->sym, s) == 0;
+}
+
+/* Turns pattern 'p', for the value at 'path', into tests in 'clause' and
+ * bindings in 'leaf'. A list is tested for its length before any of its
+ * elements, so the tests of a clause can be made in order. */
+static Value* tl_match_pattern(Value* p, int depth, int* path, MatchNode* clause, MatchNode* leaf) {
+  if (p->type == TL_INTEGER || p->type == TL_STRING) {
+    MatchNode* t = tl_match_node(TL_MATCH_EQ, depth, path);
+    t->literal = tl_val_copy(p);
+    tl_match_add(clause, t);
+    return NULL;
+  }
+
+  if (p->type == TL_SEXPR && p->count == 2 && tl_match_is(p->cell[0], "quote")) {
+    MatchNode* t = tl_match_node(TL_MATCH_EQ, depth, path);
+    t->literal = tl_val_copy(p->cell[1]);
+    tl_match_add(clause, t);
+    return NULL;
+  }
+
+  if (p->type == TL_SYMBOL) {
+    TL_ASSERT(!tl_match_is(p, "&"), "Function 'match' passed invalid pattern. "
+      "Symbol '&' outside a list");
+    if (!tl_match_is(p, "_")) tl_match_binding(leaf, p, depth, path, -1);
+    return NULL;
+  }
+
+  TL_ASSERT(p->type == TL_QEXPR,
+    "Function 'match' passed invalid pattern. Got %s", tl_type_name(p->type));
+
+  int n = p->count;
+  for (int i=0; i < p->count; i++) {
+    if (tl_match_is(p->cell[i], "&")) {
+      TL_ASSERT(i == p->count - 2 && p->cell[i+1]->type == TL_SYMBOL,
+        "Function 'match' passed invalid pattern. Symbol '&' not followed by single symbol");
+      n = i;
+      break;
+    }
+  }
+
+  tl_match_add(clause, tl_match_node(n < p->count ? TL_MATCH_REST : TL_MATCH_LIST, depth, path));
+  clause->child[clause->children - 1]->count = n;
+  if (n < p->count && !tl_match_is(p->cell[n+1], "_")) {
+    tl_match_binding(leaf, p->cell[n+1], depth, path, n);
+  }
+
+  int* sub = malloc(sizeof(int) * (depth + 1));
+  if (depth) memcpy(sub, path, sizeof(int) * depth);
+  for (int i=0; i < n; i++) {
+    sub[depth] = i;
+    Value* err = tl_match_pattern(p->cell[i], depth + 1, sub, clause, leaf);
+    if (err) {
+      free(sub);
+      return err;
+    }
+  }
+  free(sub);
+  return NULL;
+}
+
+static int tl_match_same(MatchNode* a, MatchNode* b) {
+  if (a->kind != b->kind || a->depth != b->depth) return 0;
+  if (memcmp(a->path, b->path, sizeof(int) * a->depth) != 0) return 0;
+  if (a->kind == TL_MATCH_EQ) return tl_val_eq(a->literal, b->literal);
+  return a->count == b->count;
+}
+
+/* Puts the tests of 'clause' under 'root', sharing the path of tests it
+ * has in common with the clause before it. Clauses are tried in order,
+ * so a test is only shared with the newest child at each level. */
+static void tl_match_insert(MatchNode* root, MatchNode* clause, MatchNode* leaf) {
+  MatchNode* at = root;
+  for (int i=0; i < clause->children; i++) {
+    MatchNode* t = clause->child[i];
+    MatchNode* last = at->children ? at->child[at->children - 1] : NULL;
+    if (last && last->kind != TL_MATCH_LEAF && tl_match_same(last, t)) {
+      tl_match_free(t);
+      at = last;
+    } else {
+      tl_match_add(at, t);
+      at = t;
+    }
+  }
+  tl_match_add(at, leaf);
+  clause->children = 0;
+}
+
+/* Builds the decision tree for '(match x pattern {body} ...)' and keeps
+ * it in the form's node. Returns NULL, or an error for a bad form. */
+Value* tl_match_compile(Value* form) {
+  TL_ASSERT(form->count >= 4 && form->count % 2 == 0,
+    "Function 'match' passed a pattern without a body");
+  for (int i=3; i < form->count; i += 2) {
+    TL_ASSERT(form->cell[i]->type == TL_QEXPR,
+      "Function 'match' passed incorrect type for body. Got %s, Expected %s",
+      tl_type_name(form->cell[i]->type), tl_type_name(TL_QEXPR));
+  }
+
+  MatchNode* root = tl_match_node(TL_MATCH_ROOT, 0, NULL);
+  MatchNode* clause = tl_match_node(TL_MATCH_ROOT, 0, NULL);
+  for (int i=2; i < form->count; i += 2) {
+    MatchNode* leaf = tl_match_node(TL_MATCH_LEAF, 0, NULL);
+    leaf->clause = i / 2 - 1;
+
+    Value* err = tl_match_pattern(form->cell[i], 0, NULL, clause, leaf);
+    if (err) {
+      tl_match_free(leaf);
+      tl_match_free(clause);
+      tl_match_free(root);
+      return err;
+    }
+    tl_match_insert(root, clause, leaf);
+  }
+  tl_match_free(clause);
+
+  if (form->match) tl_match_release(form->match);
+  form->match = malloc(sizeof(Match));
+  form->match->refs = 1;
+  form->match->root = root;
+  return NULL;
+}
+
+static Value* tl_match_at(Value* v, int depth, int* path) {
+  for (int i=0; i < depth; i++) v = v->cell[path[i]];
+  return v;
+}
+
+static int tl_match_test(MatchNode* n, Value* v) {
+  Value* x = tl_match_at(v, n->depth, n->path);
+  switch (n->kind) {
+    case TL_MATCH_LIST: return x->type == TL_QEXPR && x->count == n->count;
+    case TL_MATCH_REST: return x->type == TL_QEXPR && x->count >= n->count;
+    case TL_MATCH_EQ:   return tl_val_eq(x, n->literal);
+  }
+  return 1;
+}
+
+static MatchNode* tl_match_search(MatchNode* n, Value* v) {
+  if (n->kind == TL_MATCH_LEAF) return n;
+  if (!tl_match_test(n, v)) return NULL;
+  for (int i=0; i < n->children; i++) {
+    MatchNode* leaf = tl_match_search(n->child[i], v);
+    if (leaf) return leaf;
+  }
+  return NULL;
+}
+
+/* Returns the leaf of the first clause 'v', which is borrowed, matches,
+ * or NULL. Nothing is allocated. */
+MatchNode* tl_match_find(Match* m, Value* v) {
+  return tl_match_search(m->root, v);
+}
+
+/* Binds the variables of 'leaf' in 'e', the fresh scope of the clause,
+ * to copies of the parts of 'v'. */
+void tl_match_bind(MatchNode* leaf, Value* v, Env* e) {
+  Value** x = malloc(sizeof(Value*) * (leaf->binds + 1));
+  for (int i=0; i < leaf->binds; i++) {
+    Value* y = tl_match_at(v, leaf->depths[i], leaf->paths[i]);
+    if (leaf->rests[i] < 0) {
+      x[i] = tl_val_copy(y);
+      continue;
+    }
+    x[i] = tl_val_qexpr();
+    x[i]->count = y->count - leaf->rests[i];
+    x[i]->cell = malloc(sizeof(Value*) * (x[i]->count + 1));
+    for (int j=0; j < x[i]->count; j++) x[i]->cell[j] = tl_val_copy(y->cell[leaf->rests[i] + j]);
+  }
+  for (int i=0; i < leaf->binds; i++) tl_env_set(e, leaf->names[i], x[i]);
+  free(x);
+}
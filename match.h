@@ -0,0 +1,62 @@
+
+#ifndef MATCH_H_INCLUDED_
+#define MATCH_H_INCLUDED_
+
+#include "value.h"
+
+/* (match x pattern {body} pattern {body} ...) evaluates the body of the
+ * first pattern 'x' matches, with the pattern's variables bound in a
+ * scope that only lasts while the body runs. A
+ * pattern is a literal number or string, (quote x) for any other literal,
+ * a symbol to bind, '_' to match anything, or a Q-expression of patterns
+ * matching a Q-expression of that length, or of at least the length
+ * before '& rest' when it ends that way.
+ *
+ * The patterns of a 'match' are compiled once into a decision tree kept
+ * on its node and shared by copies of it. Each clause becomes a sequence
+ * of tests on the elements of 'x': a length, a literal. The clauses are
+ * merged into a tree where a test common to neighbouring clauses is made
+ * once. Tests look at 'x' in place; only what the chosen clause binds is
+ * copied. */
+
+enum { TL_MATCH_ROOT, TL_MATCH_LIST, TL_MATCH_REST, TL_MATCH_EQ, TL_MATCH_LEAF };
+
+typedef struct tl_match_node MatchNode;
+
+struct tl_match_node {
+  int kind;
+
+  // Where the tested value sits: an index at each level below 'x'
+  int depth;
+  int* path;
+
+  // TL_MATCH_LIST: the length; TL_MATCH_REST: the least length
+  int count;
+  // TL_MATCH_EQ: the literal
+  Value* literal;
+
+  // TL_MATCH_LEAF: the clause, and what it binds. A binding with a
+  // 'rest' of -1 is the value at its path, otherwise the elements of the
+  // list at its path from index 'rest' on.
+  int clause;
+  int binds;
+  Value** names;
+  int* depths;
+  int** paths;
+  int* rests;
+
+  int children;
+  MatchNode** child;
+};
+
+struct tl_match {
+  int refs;
+  MatchNode* root;
+};
+
+Value*     tl_match_compile(Value*);
+MatchNode* tl_match_find(Match*, Value*);
+void       tl_match_bind(MatchNode*, Value*, Env*);
+void       tl_match_release(Match*);
+
+#endif
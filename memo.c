@@ -0,0 +1,136 @@
+
+#include "memo.h"
+#include "builtins.h"
+
+enum { TL_MEMO_BUCKETS = 64 };
+
+/* Wraps function 'fn' in a table of at most 'capacity' entries, or no
+ * limit when 'capacity' is 0. */
+Value* tl_memo_new(Value* fn, long capacity) {
+  Memo* m = malloc(sizeof(Memo));
+  m->refs = 1;
+  m->fn = tl_val_copy(fn);
+  m->capacity = capacity;
+  m->count = 0;
+  m->hits = 0;
+  m->misses = 0;
+  m->size = TL_MEMO_BUCKETS;
+  m->buckets = calloc(m->size, sizeof(MemoEntry*));
+  m->newest = NULL;
+  m->oldest = NULL;
+
+  Value* v = malloc(sizeof(Value));
+  v->type = TL_FUNCTION;
+  v->builtin = NULL;
+  v->partial = NULL;
+  v->memo = m;
+  return v;
+}
+
+static void tl_memo_entry_delete(MemoEntry* x) {
+  for (int i=0; i < x->count; i++) tl_val_delete(x->args[i]);
+  free(x->args);
+  tl_val_delete(x->result);
+  free(x);
+}
+
+void tl_memo_release(Memo* m) {
+  if (--m->refs != 0) return;
+  MemoEntry* x = m->newest;
+  while (x) {
+    MemoEntry* older = x->older;
+    tl_memo_entry_delete(x);
+    x = older;
+  }
+  free(m->buckets);
+  tl_val_delete(m->fn);
+  free(m);
+}
+
+static unsigned long tl_memo_hash(int n, Value** a) {
+  unsigned long h = n;
+  for (int i=0; i < n; i++) h = h * 31 + tl_val_hash(a[i]);
+  return h;
+}
+
+static MemoEntry* tl_memo_find(Memo* m, unsigned long h, int n, Value** a) {
+  for (MemoEntry* x = m->buckets[h % m->size]; x; x = x->next) {
+    if (x->hash != h || x->count != n) continue;
+    int i = 0;
+    while (i < n && tl_val_eq(x->args[i], a[i])) i++;
+    if (i == n) return x;
+  }
+  return NULL;
+}
+
+static void tl_memo_unlink(Memo* m, MemoEntry* x) {
+  if (x->newer) x->newer->older = x->older; else m->newest = x->older;
+  if (x->older) x->older->newer = x->newer; else m->oldest = x->newer;
+}
+
+static void tl_memo_link(Memo* m, MemoEntry* x) {
+  x->newer = NULL;
+  x->older = m->newest;
+  if (m->newest) m->newest->newer = x; else m->oldest = x;
+  m->newest = x;
+}
+
+static void tl_memo_evict(Memo* m) {
+  MemoEntry* x = m->oldest;
+  tl_memo_unlink(m, x);
+  MemoEntry** p = &m->buckets[x->hash % m->size];
+  while (*p != x) p = &(*p)->next;
+  *p = x->next;
+  tl_memo_entry_delete(x);
+  m->count--;
+}
+
+// Doubles the buckets once there are more entries than buckets
+static void tl_memo_grow(Memo* m) {
+  int size = m->size * 2;
+  MemoEntry** buckets = calloc(size, sizeof(MemoEntry*));
+  for (MemoEntry* x = m->newest; x; x = x->older) {
+    x->next = buckets[x->hash % size];
+    buckets[x->hash % size] = x;
+  }
+  free(m->buckets);
+  m->buckets = buckets;
+  m->size = size;
+}
+
+static void tl_memo_insert(Memo* m, unsigned long h, int n, Value** a, Value* v) {
+  MemoEntry* x = malloc(sizeof(MemoEntry));
+  x->hash = h;
+  x->count = n;
+  x->args = malloc(sizeof(Value*) * n);
+  for (int i=0; i < n; i++) x->args[i] = tl_val_copy(a[i]);
+  x->result = tl_val_copy(v);
+  x->next = m->buckets[h % m->size];
+  m->buckets[h % m->size] = x;
+  tl_memo_link(m, x);
+
+  if (++m->count > m->capacity && m->capacity) tl_memo_evict(m);
+  if (m->count > m->size) tl_memo_grow(m);
+}
+
+/* Returns a copy of the result kept for the 'n' arguments in 'a', or
+ * NULL when there is none and the function has to be called. */
+Value* tl_memo_lookup(Memo* m, int n, Value** a) {
+  unsigned long h = tl_memo_hash(n, a);
+  MemoEntry* x = tl_memo_find(m, h, n, a);
+  if (!x) {
+    m->misses++;
+    return NULL;
+  }
+  m->hits++;
+  tl_memo_unlink(m, x);
+  tl_memo_link(m, x);
+  return tl_val_copy(x->result);
+}
+
+/* Keeps a copy of result 'v' of a call with the 'n' arguments in 'a'.
+ * A recursive call with the same arguments may have kept one already. */
+void tl_memo_store(Memo* m, int n, Value** a, Value* v) {
+  unsigned long h = tl_memo_hash(n, a);
+  if (v->type != TL_ERROR && !tl_memo_find(m, h, n, a)) tl_memo_insert(m, h, n, a, v);
+}
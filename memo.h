@@ -0,0 +1,51 @@
+
+#ifndef MEMO_H_INCLUDED_
+#define MEMO_H_INCLUDED_
+
+#include "value.h"
+
+/* A memoised function keeps the results of the function it wraps in a
+ * hash table keyed by the arguments, hashed with 'tl_val_hash' and
+ * compared with 'tl_val_eq'. Entries are also kept on a list from most
+ * to least recently used, so that a table with a capacity can evict the
+ * least recently used entry once it is full. Errors are not kept.
+ *
+ * Calls go through the machine, which looks the arguments up and on a
+ * miss runs the wrapped function above a frame that stores its result,
+ * so recursion through a memoised function does not use the C stack. */
+
+typedef struct tl_memo_entry MemoEntry;
+
+struct tl_memo_entry {
+  unsigned long hash;
+  int count;
+  Value** args;
+  Value* result;
+
+  MemoEntry* next;
+  MemoEntry* newer;
+  MemoEntry* older;
+};
+
+struct tl_memo {
+  int refs;
+  Value* fn;
+
+  // 'capacity' is 0 when the table is unbounded
+  long capacity;
+  long count;
+  long hits;
+  long misses;
+
+  int size;
+  MemoEntry** buckets;
+  MemoEntry* newest;
+  MemoEntry* oldest;
+};
+
+Value* tl_memo_new(Value*, long);
+Value* tl_memo_lookup(Memo*, int, Value**);
+void   tl_memo_store(Memo*, int, Value**, Value*);
+void   tl_memo_release(Memo*);
+
+#endif
@@ -122,7 +122,7 @@ void mpc_err_string_cat(char *buffer, int *pos, int *max, char *fmt, ...) {
   va_end(va);
 }
 
-static char char_unescape_buffer[3];
+static char char_unescape_buffer[4];
 
 static char *mpc_err_char_unescape(char c) {
   
@@ -320,9 +320,14 @@ typedef struct {
   mpc_state_t state;
   
   char *string;
-  char *buffer;
+  int length;
   FILE *file;
   
+  char *buffer;
+  int buffer_pos;
+  int buffer_num;
+  int buffer_slots;
+  
   int backtrack;
   int marks_num;
   mpc_state_t* marks;
@@ -332,7 +337,7 @@ typedef struct {
   
 } mpc_input_t;
 
-static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+static mpc_input_t *mpc_input_new_buffer(const char *filename, char *string, int length) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
@@ -342,11 +347,15 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
-  i->buffer = NULL;
+  i->string = string;
+  i->length = length;
   i->file = NULL;
   
+  i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
+  
   i->backtrack = 1;
   i->marks_num = 0;
   i->marks = NULL;
@@ -357,6 +366,13 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   return i;
 }
 
+static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+  int length = strlen(string);
+  char *s = malloc(length + 1);
+  memcpy(s, string, length + 1);
+  return mpc_input_new_buffer(filename, s, length);
+}
+
 static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -368,9 +384,14 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
-  i->buffer = NULL;
+  i->length = 0;
   i->file = pipe;
   
+  i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
+  
   i->backtrack = 1;
   i->marks_num = 0;
   i->marks = NULL;
@@ -392,9 +413,14 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
-  i->buffer = NULL;
+  i->length = 0;
   i->file = file;
   
+  i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
+  
   i->backtrack = 1;
   i->marks_num = 0;
   i->marks = NULL;
@@ -417,6 +443,46 @@ static void mpc_input_delete(mpc_input_t *i) {
   free(i);
 }
 
+/*
+** Pipe input is buffered from the oldest mark on,
+** so it can be read again after a rewind. The
+** buffer starts at input position `buffer_pos`
+** and holds `buffer_num` characters. It grows by
+** doubling, and when the outermost mark goes the
+** characters before the current position, which
+** can no longer be rewound to, are dropped. Any
+** after it were read ahead and are kept.
+*/
+
+static int mpc_input_buffer_in_range(mpc_input_t *i) {
+  return i->state.pos < i->buffer_pos + i->buffer_num;
+}
+
+static char mpc_input_buffer_get(mpc_input_t *i) {
+  return i->buffer[i->state.pos - i->buffer_pos];
+}
+
+static void mpc_input_buffer_add(mpc_input_t *i, char c) {
+  if (i->buffer_num == 0) { i->buffer_pos = i->state.pos; }
+  if (i->buffer_num == i->buffer_slots) {
+    i->buffer_slots = i->buffer_slots ? i->buffer_slots * 2 : 64;
+    i->buffer = realloc(i->buffer, i->buffer_slots);
+  }
+  i->buffer[i->buffer_num++] = c;
+}
+
+static void mpc_input_buffer_trim(mpc_input_t *i) {
+  int n = i->state.pos - i->buffer_pos;
+  if (n <= 0) { return; }
+  if (n >= i->buffer_num) {
+    i->buffer_num = 0;
+    return;
+  }
+  memmove(i->buffer, i->buffer + n, i->buffer_num - n);
+  i->buffer_num -= n;
+  i->buffer_pos = i->state.pos;
+}
+
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
 static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 
@@ -430,10 +496,6 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
   
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-  
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
@@ -445,8 +507,7 @@ static void mpc_input_unmark(mpc_input_t *i) {
   i->lasts = realloc(i->lasts, sizeof(char) * i->marks_num);
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
-    i->buffer = NULL;
+    mpc_input_buffer_trim(i);
   }
   
 }
@@ -465,18 +526,10 @@ static void mpc_input_rewind(mpc_input_t *i) {
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (strlen(i->buffer) + i->marks[0].pos);
-}
-
-static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
-}
-
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos == i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
-  if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_PIPE && !mpc_input_buffer_in_range(i) && feof(i->file)) { return 1; }
   return 0;
 }
 
@@ -490,9 +543,7 @@ static char mpc_input_getc(mpc_input_t *i) {
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
     
-      if (!i->buffer) { c = getc(i->file); return c; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         c = mpc_input_buffer_get(i);
         return c;
       } else {
@@ -520,14 +571,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
     
     case MPC_INPUT_PIPE:
       
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         return mpc_input_buffer_get(i);
       } else {
         c = getc(i->file);
@@ -548,9 +592,7 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); break;
     case MPC_INPUT_PIPE:
       
-      if (!i->buffer) { ungetc(c, i->file); break; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         break;
       } else {
         ungetc(c, i->file); 
@@ -563,13 +605,12 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
-  if (i->type == MPC_INPUT_PIPE &&
-      i->buffer &&
-      !mpc_input_buffer_in_range(i)) {
-    
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
+  if (i->type == MPC_INPUT_PIPE && !mpc_input_buffer_in_range(i)) {
+    if (i->marks_num) {
+      mpc_input_buffer_add(i, c);
+    } else {
+      i->buffer_num = 0;
+    }
   }
   
   i->last = c;
@@ -628,14 +669,11 @@ static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
 
 static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   
-  char *co = NULL;
   const char *x = c;
 
   mpc_input_mark(i);
   while (*x) {
-    if (mpc_input_char(i, *x, &co)) {
-      free(co);
-    } else {
+    if (!mpc_input_char(i, *x, NULL)) {
       mpc_input_rewind(i);
       return 0;
     }
@@ -936,6 +974,75 @@ static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
   return x;
 }
 
+/*
+** Repeating a single character parser and folding
+** the results with `mpcf_strfold` is how nearly
+** every token of a regex grammar is read. Run one
+** character at a time this allocates a string for
+** each character and then joins them all up, so
+** the case is spotted and run in a tight loop
+** instead. Characters are matched without being
+** copied out, and the token is taken as a slice
+** of the input, copied once, when the loop stops.
+** Input that is not a string has no buffer to
+** slice, so there the characters are gathered.
+*/
+
+static mpc_parser_t *mpc_repeat_char(mpc_parser_t *p) {
+  mpc_parser_t *x = p->data.repeat.x;
+  if (p->data.repeat.f != mpcf_strfold) { return NULL; }
+  if (x->type == MPC_TYPE_EXPECT) { x = x->data.expect.x; }
+  if (x->type >= MPC_TYPE_ANY && x->type <= MPC_TYPE_SATISFY) { return x; }
+  return NULL;
+}
+
+static int mpc_input_match(mpc_input_t *i, mpc_parser_t *x) {
+  switch (x->type) {
+    case MPC_TYPE_ANY:     return mpc_input_any(i, NULL);
+    case MPC_TYPE_SINGLE:  return mpc_input_char(i, x->data.single.x, NULL);
+    case MPC_TYPE_RANGE:   return mpc_input_range(i, x->data.range.x, x->data.range.y, NULL);
+    case MPC_TYPE_ONEOF:   return mpc_input_oneof(i, x->data.string.x, NULL);
+    case MPC_TYPE_NONEOF:  return mpc_input_noneof(i, x->data.string.x, NULL);
+    case MPC_TYPE_SATISFY: return mpc_input_satisfy(i, x->data.satisfy.f, NULL);
+    default: return 0;
+  }
+}
+
+static char *mpc_input_chars(mpc_input_t *i, mpc_parser_t *p, mpc_parser_t *x, int *n, mpc_err_t **e) {
+  
+  int start = i->state.pos;
+  int slots = 0;
+  char *s = NULL;
+  
+  *n = 0;
+  while (mpc_input_match(i, x)) {
+    if (i->type != MPC_INPUT_STRING) {
+      if (*n + 1 >= slots) {
+        slots = slots ? slots * 2 : 16;
+        s = realloc(s, slots);
+      }
+      s[*n] = i->last;
+    }
+    (*n)++;
+  }
+  
+  if (i->type == MPC_INPUT_STRING) {
+    s = malloc(*n + 1);
+    memcpy(s, i->string + start, *n);
+  }
+  if (!s) { s = malloc(1); }
+  s[*n] = '\0';
+  
+  /* The error the repeated parser would have given */
+  if (p->data.repeat.x->type == MPC_TYPE_EXPECT) {
+    *e = mpc_err_new(i->filename, i->state, p->data.repeat.x->data.expect.m, mpc_input_peekc(i));
+  } else {
+    *e = mpc_err_fail(i->filename, i->state, "Incorrect Input");
+  }
+  
+  return s;
+}
+
 /*
 ** This is rather pleasant. The core parsing routine
 ** is written in about 200 lines of C.
@@ -971,6 +1078,9 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
   
   /* Variables */
   char *s;
+  int n;
+  mpc_parser_t *x;
+  mpc_err_t *e;
   mpc_result_t r;
 
   /* Go! */
@@ -1081,6 +1191,11 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
       /* Repeat Parsers */
       
       case MPC_TYPE_MANY:
+        if (st == 0 && (x = mpc_repeat_char(p))) {
+          s = mpc_input_chars(i, p, x, &n, &e);
+          mpc_stack_err(stk, e);
+          MPC_SUCCESS(s);
+        }
         if (st == 0) { MPC_CONTINUE(st+1, p->data.repeat.x); }
         if (st >  0) {
           if (mpc_stack_peekr(stk, &r)) {
@@ -1093,6 +1208,15 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         }
       
       case MPC_TYPE_MANY1:
+        if (st == 0 && (x = mpc_repeat_char(p))) {
+          s = mpc_input_chars(i, p, x, &n, &e);
+          if (n == 0) {
+            free(s);
+            MPC_FAILURE(mpc_err_many1(e));
+          }
+          mpc_stack_err(stk, e);
+          MPC_SUCCESS(s);
+        }
         if (st == 0) { MPC_CONTINUE(st+1, p->data.repeat.x); }
         if (st >  0) {
           if (mpc_stack_peekr(stk, &r)) {
@@ -1206,7 +1330,9 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
   
   FILE *f = fopen(filename, "rb");
-  int res;
+  int res, n, length = 0, slots = 4096;
+  char *string;
+  mpc_input_t *i;
   
   if (f == NULL) {
     r->output = NULL;
@@ -1214,8 +1340,21 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
     return 0;
   }
   
-  res = mpc_parse_file(filename, f, p, r);
+  /* Read into memory so tokens can be sliced out of it */
+  string = malloc(slots);
+  while ((n = fread(string + length, 1, slots - length - 1, f)) > 0) {
+    length += n;
+    if (length == slots - 1) {
+      slots *= 2;
+      string = realloc(string, slots);
+    }
+  }
+  string[length] = '\0';
   fclose(f);
+  
+  i = mpc_input_new_buffer(filename, string, length);
+  res = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
   return res;
 }
 
@@ -2257,13 +2396,19 @@ mpc_val_t *mpcf_snd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 1)
 mpc_val_t *mpcf_trd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 2); }
 
 mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
-  char *x = calloc(1, 1);
   int i;
+  size_t l = 0, k;
+  char *x;
+  for (i = 0; i < n; i++) { l += strlen(xs[i]); }
+  x = malloc(l + 1);
+  l = 0;
   for (i = 0; i < n; i++) {
-    x = realloc(x, strlen(x) + strlen(xs[i]) + 1);
-    strcat(x, xs[i]);
+    k = strlen(xs[i]);
+    memcpy(x + l, xs[i], k);
+    l += k;
     free(xs[i]);
   }
+  x[l] = '\0';
   return x;
 }
 
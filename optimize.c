@@ -0,0 +1,545 @@
+
+#include "optimize.h"
+#include "builtins.h"
+#include "intern.h"
+#include "macro.h"
+#include "match.h"
+#include "record.h"
+
+int tl_opt_inline_size = 16;
+
+// Names defined once by 'def', and names bound again or some other way
+static Value* tl_opt_defined = NULL;
+static Value* tl_opt_rebound = NULL;
+
+// Lambdas that calls may be replaced with, by name
+static Env* tl_opt_inlines = NULL;
+
+// Code nested deeper than this is left as it is, not folded on the C stack
+#define TL_OPT_DEPTH 4096
+static int tl_opt_depth = 0;
+
+static int tl_opt_is(Value* v, char* sym) {
+  return v->type == TL_SYMBOL && strcmp(v->sym, sym) == 0;
+}
+
+static int tl_opt_member(Value* syms, char* sym) {
+  for (int i=0; i < syms->count; i++) {
+    if (tl_opt_is(syms->cell[i], sym)) return 1;
+  }
+  return 0;
+}
+
+// The variables of a 'match' pattern
+static void tl_opt_patterns(Value* p, Value* into) {
+  if (p->type == TL_SYMBOL && !tl_opt_is(p, "_") && !tl_opt_is(p, "&")) {
+    tl_val_add(into, tl_val_copy(p));
+  }
+  if (p->type != TL_QEXPR) return;
+  for (int i=0; i < p->count; i++) tl_opt_patterns(p->cell[i], into);
+}
+
+// The symbols node 'v' binds, as 'tl_opt_scan' sorts them
+static void tl_opt_binds(Value* v, Value* defined, Value* assigned) {
+  if (v->count == 3 && tl_opt_is(v->cell[0], "defrecord") && v->cell[1]->type == TL_QEXPR
+      && v->cell[1]->count == 1 && v->cell[1]->cell[0]->type == TL_SYMBOL
+      && v->cell[2]->type == TL_QEXPR) {
+    tl_val_join(defined, tl_record_names(v->cell[1]->cell[0], v->cell[2]));
+  }
+
+  if (v->count == 4 && tl_opt_is(v->cell[0], "try") && v->cell[2]->type == TL_QEXPR) {
+    for (int i=0; i < v->cell[2]->count; i++) {
+      if (v->cell[2]->cell[i]->type == TL_SYMBOL)
+        tl_val_add(assigned, tl_val_copy(v->cell[2]->cell[i]));
+    }
+  }
+
+  if (v->count >= 4 && tl_opt_is(v->cell[0], "match")) {
+    for (int i=2; i < v->count; i += 2) tl_opt_patterns(v->cell[i], assigned);
+  }
+
+  if (v->count >= 2 && v->cell[1]->type == TL_QEXPR
+      && (tl_opt_is(v->cell[0], "def") || tl_opt_is(v->cell[0], "defmacro")
+        || tl_opt_is(v->cell[0], "=")
+        || tl_opt_is(v->cell[0], "\\") || tl_opt_is(v->cell[0], "for")
+        || tl_opt_is(v->cell[0], "each") || tl_opt_is(v->cell[0], "defcell"))) {
+    Value* syms = v->cell[1];
+    Value* into = tl_opt_is(v->cell[0], "def") || tl_opt_is(v->cell[0], "defmacro")
+      ? defined : assigned;
+    for (int i=0; i < syms->count; i++) {
+      if (syms->cell[i]->type == TL_SYMBOL)
+        tl_val_add(into, tl_val_copy(syms->cell[i]));
+    }
+  }
+}
+
+/* Collects every symbol that can be bound at runtime: the targets of
+ * 'def' and the functions 'defrecord' defines into 'defined', and those
+ * of '=', lambda formals, which shadow dynamically, loop, pattern and
+ * 'try' variables, and cells, bound again as they change, into
+ * 'assigned'. */
+void tl_opt_scan(Value* v, Value* defined, Value* assigned) {
+  // Nodes still to visit, kept on a stack of their own in visiting order
+  int count = 1;
+  int size = 16;
+  Value** stack = malloc(sizeof(Value*) * size);
+  stack[0] = v;
+
+  while (count) {
+    v = stack[--count];
+    if (v->type != TL_SEXPR && v->type != TL_QEXPR) continue;
+    tl_opt_binds(v, defined, assigned);
+
+    if (count + v->count > size) {
+      size = (count + v->count) * 2;
+      stack = realloc(stack, sizeof(Value*) * size);
+    }
+    for (int i=v->count-1; i >= 0; i--) stack[count++] = v->cell[i];
+  }
+
+  free(stack);
+}
+
+static void tl_opt_rebind(Value* s) {
+  if (tl_opt_member(tl_opt_rebound, s->sym)) {
+    tl_val_delete(s);
+  } else {
+    tl_val_add(tl_opt_rebound, s);
+  }
+}
+
+void tl_opt_load(Value* program) {
+  if (!tl_opt_defined) {
+    tl_opt_defined = tl_val_qexpr();
+    tl_opt_rebound = tl_val_qexpr();
+    tl_opt_inlines = tl_env_new();
+  }
+
+  Value* defs = tl_val_qexpr();
+  Value* sets = tl_val_qexpr();
+  tl_opt_scan(program, defs, sets);
+  while (defs->count) {
+    Value* s = tl_val_pop(defs, 0);
+    if (tl_opt_member(tl_opt_defined, s->sym)) {
+      tl_opt_rebind(s);
+    } else {
+      tl_val_add(tl_opt_defined, s);
+    }
+  }
+  while (sets->count) tl_opt_rebind(tl_val_pop(sets, 0));
+  tl_val_delete(defs);
+  tl_val_delete(sets);
+}
+
+static Builtin* tl_opt_builtin(Env* e, Value* v, Value* formals) {
+  if (v->type != TL_SYMBOL) return NULL;
+  if (formals && tl_opt_member(formals, v->sym)) return NULL;
+  if (tl_opt_defined && (tl_opt_member(tl_opt_defined, v->sym)
+      || tl_opt_member(tl_opt_rebound, v->sym))) return NULL;
+
+  Value* x = tl_env_lookup(e, v);
+  if (!x || x->type != TL_FUNCTION || !x->builtin) return NULL;
+  return tl_builtin_find(x->builtin->fn) == x->builtin ? x->builtin : NULL;
+}
+
+static int tl_opt_const(Value* v) {
+  return v->type == TL_INTEGER || v->type == TL_STRING || v->type == TL_QEXPR;
+}
+
+static Value* tl_opt_inline(Value* v, Value* formals) {
+  if (v->type != TL_SYMBOL || !tl_opt_inlines) return NULL;
+  if (formals && tl_opt_member(formals, v->sym)) return NULL;
+  if (tl_opt_member(tl_opt_rebound, v->sym)) return NULL;
+  return tl_env_lookup(tl_opt_inlines, v);
+}
+
+// Nodes in 'v', counted only until there are more than 'max'
+static int tl_opt_size(Value* v, int max) {
+  if (v->type != TL_SEXPR && v->type != TL_QEXPR) return 1;
+  int n = 1;
+  for (int i=0; i < v->count && n <= max; i++) n += tl_opt_size(v->cell[i], max - n);
+  return n;
+}
+
+// Occurrences of 'sym' in 'v', looking into Q-Expressions only if 'deep'
+static int tl_opt_uses(Value* v, char* sym, int deep) {
+  if (v->type == TL_SYMBOL) return strcmp(v->sym, sym) == 0;
+  if (v->type == TL_QEXPR && !deep) return 0;
+  if (v->type != TL_SEXPR && v->type != TL_QEXPR) return 0;
+  int n = 0;
+  for (int i=0; i < v->count; i++) n += tl_opt_uses(v->cell[i], sym, deep);
+  return n;
+}
+
+static int tl_opt_mentions(Value* v, Value* formals) {
+  for (int i=0; i < formals->count; i++) {
+    if (tl_opt_uses(v, formals->cell[i]->sym, 1)) return 1;
+  }
+  return 0;
+}
+
+/* A body can be inlined when nothing in it could see the formals by
+ * name under dynamic scope: it may only apply pure builtins, 'if' and
+ * other inlinable lambdas, and formals may not appear in quoted data. */
+static int tl_opt_safe(Env* e, Value* v, Value* formals) {
+  if (v->type == TL_QEXPR) return !tl_opt_mentions(v, formals);
+  if (v->type != TL_SEXPR) return 1;
+  if (v->count == 0) return 1;
+  if (v->count == 1 && tl_opt_const(v->cell[0])) return 1;
+
+  Builtin* b = tl_opt_builtin(e, v->cell[0], formals);
+  if (b && b->fn == builtin_quote) return !tl_opt_mentions(v, formals);
+  if (b && b->fn == builtin_lambda) return 0;
+
+  if (b && b->fn == builtin_if && v->count == 4) {
+    for (int i=2; i < 4; i++) {
+      if (v->cell[i]->type != TL_QEXPR) continue;
+      v->cell[i]->type = TL_SEXPR;
+      int ok = tl_opt_safe(e, v->cell[i], formals);
+      v->cell[i]->type = TL_QEXPR;
+      if (!ok) return 0;
+    }
+  } else if (!(b && (b->flags & TL_PURE)) && !tl_opt_inline(v->cell[0], formals)) {
+    return 0;
+  }
+
+  for (int i=1; i < v->count; i++) {
+    if (v->cell[i]->type == TL_QEXPR && b && b->fn == builtin_if) continue;
+    if (!tl_opt_safe(e, v->cell[i], formals)) return 0;
+  }
+  return 1;
+}
+
+/* Records a top-level '(def {name} (\ {formals} {body}))' whose lambda
+ * is small enough, and safe, to be substituted at its call sites. */
+static void tl_opt_define(Env* e, Value* v) {
+  if (tl_opt_inline_size <= 0 || !tl_opt_inlines) return;
+  if (v->type != TL_SEXPR || v->count != 3) return;
+  if (!tl_opt_builtin(e, v->cell[0], NULL)
+      || tl_opt_builtin(e, v->cell[0], NULL)->fn != builtin_def) return;
+
+  Value* name = v->cell[1];
+  Value* fn = v->cell[2];
+  if (name->type != TL_QEXPR || name->count != 1 || name->cell[0]->type != TL_SYMBOL) return;
+  if (tl_opt_member(tl_opt_rebound, name->cell[0]->sym)) return;
+  if (fn->type != TL_SEXPR || fn->count != 3
+      || !tl_opt_builtin(e, fn->cell[0], NULL)
+      || tl_opt_builtin(e, fn->cell[0], NULL)->fn != builtin_lambda) return;
+
+  Value* formals = fn->cell[1];
+  Value* body = fn->cell[2];
+  if (formals->type != TL_QEXPR || body->type != TL_QEXPR) return;
+  for (int i=0; i < formals->count; i++) {
+    if (formals->cell[i]->type != TL_SYMBOL || tl_opt_is(formals->cell[i], "&")) return;
+  }
+  if (tl_opt_size(body, tl_opt_inline_size) > tl_opt_inline_size) return;
+
+  body->type = TL_SEXPR;
+  int ok = tl_opt_safe(e, body, formals);
+  body->type = TL_QEXPR;
+  if (!ok) return;
+
+  tl_env_set(tl_opt_inlines, name->cell[0],
+    tl_val_lambda(tl_val_copy(formals), tl_val_copy(body)));
+}
+
+static Value* tl_opt_subst(Value* v, Value* formals, Value** args) {
+  if (v->type == TL_SYMBOL) {
+    for (int i=0; i < formals->count; i++) {
+      if (strcmp(formals->cell[i]->sym, v->sym) == 0) {
+        tl_val_delete(v);
+        return tl_val_copy(args[i]);
+      }
+    }
+  }
+  if (v->type == TL_SEXPR || v->type == TL_QEXPR) {
+    for (int i=0; i < v->count; i++) v->cell[i] = tl_opt_subst(v->cell[i], formals, args);
+  }
+  return v;
+}
+
+/* Arguments are substituted for the formals. Anything other than an
+ * atom must be used exactly once and unconditionally, so that it is
+ * still evaluated once; only one such argument keeps the order too. */
+static int tl_opt_substitutable(Value* fn, int n, Value** args) {
+  if (n != fn->formals->count) return 0;
+  int exprs = 0;
+  for (int i=0; i < n; i++) {
+    if (args[i]->type != TL_SEXPR) continue;
+    char* sym = fn->formals->cell[i]->sym;
+    if (++exprs > 1) return 0;
+    int uses = 0;
+    for (int j=0; j < fn->body->count; j++) uses += tl_opt_uses(fn->body->cell[j], sym, 0);
+    if (uses != 1 || tl_opt_uses(fn->body, sym, 1) != 1) return 0;
+  }
+  return 1;
+}
+
+/* The integer operations that run unboxed, numbered from 1 in 'unboxed'
+ * on the S-expressions that apply them, from the same tables as the
+ * kernels. */
+#define TL_OPT_ENUM(name, ...) TL_OPT_##name,
+enum { TL_OPT_BOXED, TL_ARITH_OPS(TL_OPT_ENUM) TL_ORD_OPS(TL_OPT_ENUM) TL_OPT_eq, TL_OPT_ne };
+
+static int tl_opt_operator(tl_builtin fn, int n) {
+#define TL_OPT_ARITH(name, ...) if (fn == builtin_##name) return TL_OPT_##name;
+#define TL_OPT_ORD(name, ...) if (fn == builtin_##name && n == 2) return TL_OPT_##name;
+  TL_ARITH_OPS(TL_OPT_ARITH)
+  TL_ORD_OPS(TL_OPT_ORD)
+  if (fn == builtin_eq && n == 2) return TL_OPT_eq;
+  if (fn == builtin_ne && n == 2) return TL_OPT_ne;
+  return TL_OPT_BOXED;
+}
+
+/* Type inference for integer code. An integer operation applied to
+ * literals, variables and other such operations gives an integer whenever
+ * the variables it reads hold integers, so is marked to run without its
+ * builtin, argument checks or boxed intermediate results. */
+static Value* tl_opt_unbox(Value* v, Builtin* b) {
+  v->unboxed = tl_opt_operator(b->fn, v->count - 1);
+  for (int i=1; i < v->count && v->unboxed; i++) {
+    Value* x = v->cell[i];
+    if (x->type != TL_INTEGER && x->type != TL_SYMBOL
+        && !(x->type == TL_SEXPR && x->unboxed)) v->unboxed = TL_OPT_BOXED;
+  }
+  return v;
+}
+
+/* Runs unboxed integer operation 'v' into 'x'. Fails, for the boxed path
+ * to run it instead, when a variable it reads is not an integer. */
+int tl_opt_unboxed(Env* e, Value* v, long* x) {
+  if (v->type == TL_INTEGER) {
+    *x = v->num;
+    return 1;
+  }
+  if (v->type == TL_SYMBOL) {
+    Value* y = tl_env_lookup(e, v);
+    if (!y || y->type != TL_INTEGER) return 0;
+    *x = y->num;
+    return 1;
+  }
+  if ((v->type != TL_SEXPR && v->type != TL_QEXPR) || !v->unboxed) return 0;
+
+  long r, y;
+  if (!tl_opt_unboxed(e, v->cell[1], &r)) return 0;
+  if (v->count == 2) {
+#define TL_OPT_UNARY(name, sym, op, unary) case TL_OPT_##name: { long x = r; r = unary; break; }
+    switch (v->unboxed) { TL_ARITH_OPS(TL_OPT_UNARY) }
+  }
+  for (int i=2; i < v->count; i++) {
+    if (!tl_opt_unboxed(e, v->cell[i], &y)) return 0;
+#define TL_OPT_BINARY(name, sym, op, ...) case TL_OPT_##name: r = r op y; break;
+    switch (v->unboxed) {
+      TL_ARITH_OPS(TL_OPT_BINARY)
+      TL_ORD_OPS(TL_OPT_BINARY)
+      case TL_OPT_eq: r = r == y; break;
+      case TL_OPT_ne: r = r != y; break;
+    }
+  }
+  *x = r;
+  return 1;
+}
+
+static Value* tl_opt_code(Env*, Value*, Value*);
+
+/* Folds the value and bodies of a 'match', whose pattern variables are
+ * bound around each body, and builds its decision tree. A bad form is
+ * left for evaluation, which reports the error. */
+static Value* tl_opt_match(Env* e, Value* v, Value* formals) {
+  v->cell[1] = tl_opt_code(e, v->cell[1], formals);
+  for (int i=3; i < v->count; i += 2) {
+    if (v->cell[i]->type != TL_QEXPR) continue;
+    Value* inner = tl_val_qexpr();
+    tl_opt_patterns(v->cell[i-1], inner);
+    if (formals) inner = tl_val_join(inner, tl_val_copy(formals));
+    v->cell[i] = tl_opt_body(e, v->cell[i], inner);
+    tl_val_delete(inner);
+  }
+
+  Value* err = tl_match_compile(v);
+  if (err) tl_val_delete(err);
+  return v;
+}
+
+static Value* tl_opt_node(Env*, Value*, Value*);
+
+static Value* tl_opt_code(Env* e, Value* v, Value* formals) {
+  if (v->type != TL_SEXPR || tl_opt_depth >= TL_OPT_DEPTH) return v;
+  tl_opt_depth++;
+  v = tl_opt_node(e, v, formals);
+  tl_opt_depth--;
+  return v;
+}
+
+static Value* tl_opt_node(Env* e, Value* v, Value* formals) {
+  // Macro calls are expanded here, once. An expansion that fails is left
+  // for evaluation, which reports the error.
+  Value* m = v->count >= 2 && v->cell[0]->type == TL_SYMBOL
+    && !(formals && tl_opt_member(formals, v->cell[0]->sym))
+    ? tl_env_lookup(e, v->cell[0]) : NULL;
+  if (m && tl_macro_is(m)) {
+    Value* x = tl_macro_expand(e, m, v);
+    if (x->type == TL_ERROR) {
+      tl_val_delete(x);
+      return v;
+    }
+    tl_val_delete(v);
+    return tl_opt_code(e, x, formals);
+  }
+
+  Builtin* b = v->count >= 2 ? tl_opt_builtin(e, v->cell[0], formals) : NULL;
+  if (b && b->fn == builtin_quote) return v;
+  if (b && b->fn == builtin_match) return tl_opt_match(e, v, formals);
+
+  for (int i=0; i < v->count; i++) v->cell[i] = tl_opt_code(e, v->cell[i], formals);
+
+  // A single element is evaluated, not called, so (f) is left alone
+  Value* fn = v->count >= 2 ? tl_opt_inline(v->cell[0], formals) : NULL;
+  if (fn && tl_opt_substitutable(fn, v->count-1, v->cell+1)) {
+    Value* x = tl_opt_subst(tl_val_copy(fn->body), fn->formals, v->cell+1);
+    tl_val_delete(v);
+    x->type = TL_SEXPR;
+    x = tl_opt_code(e, x, formals);
+    return x->type == TL_SEXPR && x->count == 1 && tl_opt_const(x->cell[0])
+      ? tl_val_take(x, 0) : x;
+  }
+
+  if (!b) return v;
+
+  if (b->fn == builtin_if && v->count == 4
+      && v->cell[2]->type == TL_QEXPR && v->cell[3]->type == TL_QEXPR) {
+    v->cell[2] = tl_opt_body(e, v->cell[2], formals);
+    v->cell[3] = tl_opt_body(e, v->cell[3], formals);
+    if (v->cell[1]->type != TL_INTEGER) return v;
+
+    Value* x = tl_val_take(v, v->cell[1]->num ? 2 : 3);
+    x->type = TL_SEXPR;
+    return x->count == 1 && tl_opt_const(x->cell[0]) ? tl_val_take(x, 0) : x;
+  }
+
+  if (b->fn == builtin_try && v->count == 4 && v->cell[1]->type == TL_QEXPR
+      && v->cell[2]->type == TL_QEXPR && v->cell[3]->type == TL_QEXPR) {
+    v->cell[1] = tl_opt_body(e, v->cell[1], formals);
+    Value* inner = tl_val_copy(v->cell[2]);
+    if (formals) inner = tl_val_join(inner, tl_val_copy(formals));
+    v->cell[3] = tl_opt_body(e, v->cell[3], inner);
+    tl_val_delete(inner);
+    return v;
+  }
+
+  if (b->fn == builtin_lambda && v->count == 3
+      && v->cell[1]->type == TL_QEXPR && v->cell[2]->type == TL_QEXPR) {
+    // Formals of enclosing lambdas stay visible under dynamic scope
+    Value* inner = tl_val_copy(v->cell[1]);
+    if (formals) inner = tl_val_join(inner, tl_val_copy(formals));
+    v->cell[2] = tl_opt_body(e, v->cell[2], inner);
+    tl_val_delete(inner);
+    return v;
+  }
+
+  if (!(b->flags & TL_PURE)) return v;
+  for (int i=1; i < v->count; i++) {
+    if (!tl_opt_const(v->cell[i])) return tl_opt_unbox(v, b);
+  }
+
+  // Errors are left for run time, as are results that are not literals
+  Value* x = tl_builtin_call(e, b, v->count-1, v->cell+1);
+  if (!tl_opt_const(x)) {
+    tl_val_delete(x);
+    return v;
+  }
+  tl_val_delete(v);
+  return x;
+}
+
+Value* tl_opt_fold(Env* e, Value* v) {
+  v = tl_opt_code(e, v, NULL);
+  tl_opt_define(e, v);
+  return v;
+}
+
+/* Folds a lambda body or 'if' branch. 'formals' are the names bound
+ * locally around it, which may shadow builtins. */
+Value* tl_opt_body(Env* e, Value* body, Value* formals) {
+  body->type = TL_SEXPR;
+  Value* x = tl_opt_code(e, body, formals);
+
+  if (x->type == TL_SEXPR) {
+    x->type = TL_QEXPR;
+    return x;
+  }
+  return tl_val_add(tl_val_qexpr(), x);
+}
+
+/* Puts constants 'vals' in place of 'names' wherever 'v' runs as code:
+ * in S-expressions and the branches of an 'if', but not in quoted data
+ * or the bodies of lambdas, which may run anywhere later. */
+static Value* tl_opt_constants(Env* e, Value* v, Value* names, Value** vals, Value* formals) {
+  if (v->type == TL_SYMBOL) {
+    for (int i=0; i < names->count; i++) {
+      if (vals[i] && tl_opt_is(v, names->cell[i]->sym)) {
+        tl_val_delete(v);
+        return tl_intern_thaw(tl_val_copy(vals[i]));
+      }
+    }
+    return v;
+  }
+  if (v->type != TL_SEXPR || tl_opt_depth >= TL_OPT_DEPTH) return v;
+
+  Builtin* b = v->count >= 2 ? tl_opt_builtin(e, v->cell[0], formals) : NULL;
+  if (b && b->fn == builtin_quote) return v;
+
+  tl_opt_depth++;
+  for (int i=0; i < v->count; i++) {
+    Value* x = v->cell[i];
+    if (x->type != TL_QEXPR) {
+      v->cell[i] = tl_opt_constants(e, x, names, vals, formals);
+    } else if (b && b->fn == builtin_if && i >= 2) {
+      x->type = TL_SEXPR;
+      v->cell[i] = tl_opt_constants(e, x, names, vals, formals);
+      v->cell[i]->type = TL_QEXPR;
+    }
+  }
+  tl_opt_depth--;
+  return v;
+}
+
+/* Partially evaluates lambda 'fn' for its first 'n' arguments 'a'. The
+ * arguments are bound in the residual lambda as they would be by partial
+ * application, and those that are constants and never rebound in the
+ * body are also put in place of their formals, so that the body can be
+ * folded: conditionals on them are decided and builtins applied to them
+ * are worked out ahead of time. */
+Value* tl_opt_specialize(Env* e, Value* fn, int n, Value** a) {
+  Value* x = fn->partial ? tl_val_unpartial(fn) : tl_val_copy(fn);
+  Value* formals = tl_val_copy(x->formals);
+  Value* names = tl_val_qexpr();
+  Value** vals = malloc(sizeof(Value*) * (n + 1));
+
+  Value* bound = tl_val_qexpr();
+  tl_opt_scan(x->body, bound, bound);
+  for (int i=0; i < n; i++) {
+    Value* s = x->formals->cell[i];
+    tl_val_add(names, tl_val_copy(s));
+    vals[i] = (tl_opt_const(a[i]) || a[i]->type == TL_FUNCTION)
+      && !tl_opt_member(bound, s->sym) ? a[i] : NULL;
+  }
+  tl_val_delete(bound);
+
+  Value* body = tl_intern_thaw(tl_val_copy(x->body));
+  body->type = TL_SEXPR;
+  body = tl_opt_constants(e, body, names, vals, formals);
+  body->type = TL_QEXPR;
+  tl_val_body(x, tl_opt_body(e, body, formals));
+
+  for (int i=0; i < n; i++) {
+    Value* s = tl_val_pop(x->formals, 0);
+    tl_env_set(x->env, s, tl_val_copy(a[i]));
+    tl_val_delete(s);
+  }
+
+  free(vals);
+  tl_val_delete(names);
+  tl_val_delete(formals);
+  return x;
+}
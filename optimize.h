@@ -0,0 +1,31 @@
+
+#ifndef OPTIMIZE_H_INCLUDED_
+#define OPTIMIZE_H_INCLUDED_
+
+#include "value.h"
+
+/* Rewrites code before it runs: pure builtins applied to constants are
+ * folded and an 'if' on a constant condition is replaced by its branch.
+ * A builtin is only folded while the binding in scope is still the
+ * original from the builtin table and no loaded program rebinds it.
+ *
+ * Calls to small lambdas defined once at the top level are replaced by
+ * their bodies. 'tl_opt_inline_size' is the largest body, counted in
+ * nodes, that is inlined; 0 turns inlining off.
+ *
+ * Integer operations on variables are marked to run unboxed, through
+ * 'tl_opt_unboxed', while those variables hold integers.
+ *
+ * 'tl_opt_specialize' applies the same folding at run time, to a lambda
+ * body with some of its arguments known. */
+
+extern int tl_opt_inline_size;
+
+void   tl_opt_scan(Value*, Value*, Value*);
+void   tl_opt_load(Value*);
+Value* tl_opt_fold(Env*, Value*);
+Value* tl_opt_body(Env*, Value*, Value*);
+Value* tl_opt_specialize(Env*, Value*, int, Value**);
+int    tl_opt_unboxed(Env*, Value*, long*);
+
+#endif
@@ -0,0 +1,230 @@
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "reader.h"
+
+typedef struct {
+  char* filename;
+  char* input;
+  char* s;
+
+  // The elements read so far of every list still open, in order
+  Value** items;
+  int count;
+  int capacity;
+
+  // For each open list, its closing bracket and its first element
+  char* closes;
+  int* starts;
+  int depth;
+  int room;
+} Reader;
+
+static void tl_read_push(Reader* r, Value* v) {
+  if (r->count == r->capacity) {
+    r->capacity = r->capacity ? r->capacity * 2 : 64;
+    r->items = realloc(r->items, sizeof(Value*) * r->capacity);
+  }
+  r->items[r->count++] = v;
+}
+
+static void tl_read_open(Reader* r, char close) {
+  if (r->depth == r->room) {
+    r->room = r->room ? r->room * 2 : 16;
+    r->closes = realloc(r->closes, r->room);
+    r->starts = realloc(r->starts, sizeof(int) * r->room);
+  }
+  r->closes[r->depth] = close;
+  r->starts[r->depth++] = r->count;
+}
+
+// Moves the elements from 'start' on into the empty list 'v'
+static Value* tl_read_list(Reader* r, Value* v, int start) {
+  v->count = r->count - start;
+  if (v->count) {
+    v->cell = malloc(sizeof(Value*) * v->count);
+    memcpy(v->cell, r->items + start, sizeof(Value*) * v->count);
+  }
+  r->count = start;
+  return v;
+}
+
+// What may come next at the current depth
+static char* tl_read_expected(Reader* r) {
+  if (!r->depth) return "expression or end of input";
+  return r->closes[r->depth - 1] == ')' ? "expression or ')'" : "expression or '}'";
+}
+
+static Value* tl_read_error(Reader* r, char* expected) {
+  int row = 1, col = 1;
+  for (char* p = r->input; p < r->s; p++) {
+    if (*p == '\n') { row++; col = 1; } else { col++; }
+  }
+
+  char quoted[4] = { '\'', *r->s, '\'', '\0' };
+  char* at = quoted;
+  switch (*r->s) {
+    case '\0': at = "end of input"; break;
+    case '\n': at = "newline"; break;
+    case '\r': at = "carriage return"; break;
+    case '\t': at = "tab"; break;
+  }
+  return tl_val_error("%s:%i:%i: error: expected %s at %s",
+    r->filename, row, col, expected, at);
+}
+
+static int tl_read_symbolic(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+    || (c && strchr("_+-*/\\=<>!&", c));
+}
+
+static Value* tl_read_symbol(Reader* r) {
+  char* p = r->s;
+  while (tl_read_symbolic(*p)) p++;
+
+  Value* v = malloc(sizeof(Value));
+  v->type = TL_SYMBOL;
+  v->num = 0;
+  v->sym = malloc(p - r->s + 1);
+  memcpy(v->sym, r->s, p - r->s);
+  v->sym[p - r->s] = '\0';
+  r->s = p;
+  return v;
+}
+
+/* Reads the string at 'r->s' and replaces its escapes as 'mpcf_unescape'
+ * does. Returns NULL, leaving 'r->s' at the end, when it is not closed. */
+static Value* tl_read_string(Reader* r) {
+  char* p = r->s + 1;
+  while (*p && *p != '"') p += p[0] == '\\' && p[1] ? 2 : 1;
+  if (!*p) {
+    r->s = p;
+    return NULL;
+  }
+
+  static char* escapes = "abfnrtv\\'\"0";
+  static char* chars = "\a\b\f\n\r\t\v\\'\"";
+
+  char* str = malloc(p - r->s);
+  char* q = str;
+  for (char* c = r->s + 1; c < p; c++) {
+    char* k = c[0] == '\\' && c + 1 < p ? strchr(escapes, c[1]) : NULL;
+    if (!k) {
+      *q++ = *c;
+      continue;
+    }
+    if (k[0] != '0') *q++ = chars[k - escapes];
+    c++;
+  }
+  *q = '\0';
+  r->s = p + 1;
+
+  Value* v = malloc(sizeof(Value));
+  v->type = TL_STRING;
+  v->str = str;
+  return v;
+}
+
+/* Reads every form in 'input', reporting errors as being in 'filename'.
+ * Returns an S-expression of the forms, or an error. */
+Value* tl_read(char* filename, char* input) {
+  Reader r = { filename, input, input, NULL, 0, 0, NULL, NULL, 0, 0 };
+  Value* err = NULL;
+
+  while (1) {
+    char c = *r.s;
+
+    if (c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+      r.s++;
+      continue;
+    }
+
+    if (c == ';') {
+      while (*r.s && *r.s != '\n' && *r.s != '\r') r.s++;
+      continue;
+    }
+
+    if (c == '(' || c == '{') {
+      tl_read_open(&r, c == '(' ? ')' : '}');
+      r.s++;
+      continue;
+    }
+
+    if (c == ')' || c == '}') {
+      if (!r.depth || r.closes[r.depth - 1] != c) {
+        err = tl_read_error(&r, tl_read_expected(&r));
+        break;
+      }
+      r.depth--;
+      r.s++;
+      tl_read_push(&r, tl_read_list(&r,
+        c == ')' ? tl_val_sexpr() : tl_val_qexpr(), r.starts[r.depth]));
+      continue;
+    }
+
+    if (c == '\0') {
+      if (r.depth) err = tl_read_error(&r, tl_read_expected(&r));
+      break;
+    }
+
+    if ((c >= '0' && c <= '9') || (c == '-' && r.s[1] >= '0' && r.s[1] <= '9')) {
+      errno = 0;
+      long x = strtol(r.s, &r.s, 10);
+      tl_read_push(&r, errno != ERANGE ? tl_val_num(x) : tl_val_error("Invalid number"));
+      continue;
+    }
+
+    if (tl_read_symbolic(c)) {
+      tl_read_push(&r, tl_read_symbol(&r));
+      continue;
+    }
+
+    if (c == '"') {
+      Value* x = tl_read_string(&r);
+      if (!x) {
+        err = tl_read_error(&r, "'\"'");
+        break;
+      }
+      tl_read_push(&r, x);
+      continue;
+    }
+
+    err = tl_read_error(&r, tl_read_expected(&r));
+    break;
+  }
+
+  Value* x = err;
+  if (err) {
+    for (int i=0; i < r.count; i++) tl_val_delete(r.items[i]);
+  } else {
+    x = tl_read_list(&r, tl_val_sexpr(), 0);
+  }
+  free(r.items);
+  free(r.closes);
+  free(r.starts);
+  return x;
+}
+
+// Reads every form in the file 'filename'
+Value* tl_read_file(char* filename) {
+  FILE* f = fopen(filename, "rb");
+  if (!f) return tl_val_error("%s: error: Unable to open file!", filename);
+
+  size_t size = 0, room = 1 << 16;
+  char* input = malloc(room);
+  size_t n;
+  while ((n = fread(input + size, 1, room - size - 1, f)) > 0) {
+    size += n;
+    if (size == room - 1) {
+      room *= 2;
+      input = realloc(input, room);
+    }
+  }
+  fclose(f);
+  input[size] = '\0';
+
+  Value* x = tl_read(filename, input);
+  free(input);
+  return x;
+}
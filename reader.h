@@ -0,0 +1,28 @@
+
+#ifndef READER_H_INCLUDED_
+#define READER_H_INCLUDED_
+
+#include "value.h"
+
+/* Reads programs into Values in a single pass over the source, without
+ * building a parse tree first. Open lists are kept on an explicit stack,
+ * so nesting is limited only by memory, and the elements of a list are
+ * gathered there and put into it in one allocation when it closes.
+ *
+ * The syntax is the one the mpc grammar used to give:
+ *
+ *   number  : /-?[0-9]+/
+ *   symbol  : /[a-zA-Z0-9_+\-*\/\\=<>!&]+/
+ *   string  : /"(\\.|[^"])*"/
+ *   comment : ';' up to the end of the line
+ *   sexpr   : '(' <expr>* ')'
+ *   qexpr   : '{' <expr>* '}'
+ *
+ * A number is tried before a symbol, so "1-2" reads as 1 and -2. Either
+ * returns the top-level forms as an S-expression, or an error whose text
+ * is 'file:row:col: error: expected ... at ...'. */
+
+Value* tl_read(char*, char*);
+Value* tl_read_file(char*);
+
+#endif
@@ -0,0 +1,89 @@
+
+#include <stdio.h>
+
+#include "record.h"
+
+static Value* tl_record_value(Record* r) {
+  Value* v = malloc(sizeof(Value));
+  v->type = TL_RECORD;
+  v->record = r;
+  return v;
+}
+
+// The type named 'name' with the fields named in Q-expression 'fields'
+Value* tl_record_type(char* name, Value* fields) {
+  Record* t = malloc(sizeof(Record));
+  t->refs = 1;
+  t->type = NULL;
+  t->count = fields->count;
+  t->fields = NULL;
+  t->name = malloc(strlen(name) + 1);
+  strcpy(t->name, name);
+  t->names = malloc(sizeof(char*) * (t->count + 1));
+  for (int i=0; i < t->count; i++) {
+    t->names[i] = malloc(strlen(fields->cell[i]->sym) + 1);
+    strcpy(t->names[i], fields->cell[i]->sym);
+  }
+  return tl_record_value(t);
+}
+
+// A record of 'type' holding copies of the values in 'a'
+Value* tl_record_new(Record* type, Value** a) {
+  Record* r = malloc(sizeof(Record));
+  r->refs = 1;
+  r->type = type;
+  type->refs++;
+  r->count = type->count;
+  r->fields = malloc(sizeof(Value*) * (r->count + 1));
+  for (int i=0; i < r->count; i++) r->fields[i] = tl_val_copy(a[i]);
+  r->name = NULL;
+  r->names = NULL;
+  return tl_record_value(r);
+}
+
+// A record like 'r' with field 'i' set to a copy of 'x'
+Value* tl_record_with(Record* r, int i, Value* x) {
+  Value** a = malloc(sizeof(Value*) * (r->count + 1));
+  memcpy(a, r->fields, sizeof(Value*) * r->count);
+  a[i] = x;
+  Value* v = tl_record_new(r->type, a);
+  free(a);
+  return v;
+}
+
+void tl_record_release(Record* r) {
+  if (--r->refs != 0) return;
+  if (r->type) {
+    for (int i=0; i < r->count; i++) tl_val_delete(r->fields[i]);
+    free(r->fields);
+    tl_record_release(r->type);
+  } else {
+    for (int i=0; i < r->count; i++) free(r->names[i]);
+    free(r->names);
+    free(r->name);
+  }
+  free(r);
+}
+
+static Value* tl_record_symbol(char* fmt, char* name, char* field) {
+  char* s = malloc(strlen(fmt) + strlen(name) + strlen(field) + 1);
+  sprintf(s, fmt, name, field);
+  Value* v = tl_val_symbol(s);
+  free(s);
+  return v;
+}
+
+/* The names 'defrecord' defines for type symbol 'name' with the fields
+ * in 'fields': the constructor 'name', the predicate 'is-name', then for
+ * each field 'f' the accessor 'name-f' and the updater 'name-with-f'. */
+Value* tl_record_names(Value* name, Value* fields) {
+  Value* x = tl_val_qexpr();
+  tl_val_add(x, tl_record_symbol("%s%s", name->sym, ""));
+  tl_val_add(x, tl_record_symbol("is-%s%s", name->sym, ""));
+  for (int i=0; i < fields->count; i++) {
+    if (fields->cell[i]->type != TL_SYMBOL) continue;
+    tl_val_add(x, tl_record_symbol("%s-%s", name->sym, fields->cell[i]->sym));
+    tl_val_add(x, tl_record_symbol("%s-with-%s", name->sym, fields->cell[i]->sym));
+  }
+  return x;
+}
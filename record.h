@@ -0,0 +1,36 @@
+
+#ifndef RECORD_H_INCLUDED_
+#define RECORD_H_INCLUDED_
+
+#include "value.h"
+
+/* Records of the types made by 'defrecord'. A record keeps the values of
+ * its fields in an array, in the order its type names them, so a field
+ * is reached by its offset. Records never change: copies share one
+ * 'Record' and an update makes a new one.
+ *
+ * A record type is a record value too, with no type of its own, a name
+ * and the names of its fields. 'defrecord' defines a constructor, a
+ * predicate, an accessor and an updater for each field as small lambdas
+ * over the type and the field's offset, so names are looked up once. */
+
+struct tl_record {
+  int refs;
+  Record* type;
+  int count;
+
+  // A record: the values of its fields
+  Value** fields;
+
+  // A record type: its name and the names of its fields
+  char* name;
+  char** names;
+};
+
+Value* tl_record_type(char*, Value*);
+Value* tl_record_new(Record*, Value**);
+Value* tl_record_with(Record*, int, Value*);
+Value* tl_record_names(Value*, Value*);
+void   tl_record_release(Record*);
+
+#endif
@@ -0,0 +1,224 @@
+
+#include "seq.h"
+#include "builtins.h"
+
+static Seq* tl_seq_alloc(int kind) {
+  Seq* s = malloc(sizeof(Seq));
+  s->refs = 1;
+  s->kind = kind;
+  s->first = NULL;
+  s->rest = NULL;
+  s->from = 0;
+  s->to = 0;
+  s->step = 0;
+  s->fn = NULL;
+  s->x = NULL;
+  s->src = NULL;
+  return s;
+}
+
+// Wraps node 's' as a value, taking over the caller's reference
+Value* tl_seq_new(Seq* s) {
+  Value* v = malloc(sizeof(Value));
+  v->type = TL_SEQ;
+  v->seq = s;
+  return v;
+}
+
+// Lambdas are held as partial applications, which copy without copying
+// the lambda, so every node of a sequence can share one
+static Value* tl_seq_share(Value* fn) {
+  if (fn->builtin || fn->partial || fn->memo) return tl_val_copy(fn);
+  return tl_val_partial(tl_val_copy(fn), 0, NULL);
+}
+
+Seq* tl_seq_range(long from, long to, long step) {
+  Seq* s = tl_seq_alloc(TL_SEQ_RANGE);
+  s->from = from;
+  s->to = to;
+  s->step = step;
+  return s;
+}
+
+Seq* tl_seq_iterate(Value* fn, Value* x) {
+  Seq* s = tl_seq_alloc(TL_SEQ_ITERATE);
+  s->fn = tl_seq_share(fn);
+  s->x = tl_val_copy(x);
+  return s;
+}
+
+Seq* tl_seq_repeat(Value* x, long n) {
+  Seq* s = tl_seq_alloc(TL_SEQ_REPEAT);
+  s->x = tl_val_copy(x);
+  s->to = n;
+  return s;
+}
+
+// A TL_SEQ_MAP or TL_SEQ_FILTER node, taking over the reference to 'src'
+Seq* tl_seq_map(int kind, Value* fn, Seq* src) {
+  Seq* s = tl_seq_alloc(kind);
+  s->fn = tl_seq_share(fn);
+  s->src = src;
+  return s;
+}
+
+static void tl_seq_clear(Seq* s) {
+  if (s->fn) tl_val_delete(s->fn);
+  if (s->x) tl_val_delete(s->x);
+  if (s->src) tl_seq_release(s->src);
+  s->fn = NULL;
+  s->x = NULL;
+  s->src = NULL;
+}
+
+void tl_seq_release(Seq* s) {
+  // A forced chain can be long, so it is freed in a loop
+  while (s && --s->refs == 0) {
+    Seq* rest = s->rest;
+    if (s->first) tl_val_delete(s->first);
+    tl_seq_clear(s);
+    free(s);
+    s = rest;
+  }
+}
+
+/* Works out the first element of 's' and the node of the rest, without
+ * changing 's'. '*first' is left NULL at the end of the sequence. */
+static Value* tl_seq_uncons(Seq* s, Env* e, Value** first, Seq** rest) {
+  *first = NULL;
+  *rest = NULL;
+
+  switch (s->kind) {
+    case TL_SEQ_CELL:
+      if (s->first) {
+        *first = tl_val_copy(s->first);
+        *rest = s->rest;
+        s->rest->refs++;
+      }
+      return NULL;
+
+    case TL_SEQ_RANGE:
+      if (s->step > 0 ? s->from >= s->to : s->from <= s->to) return NULL;
+      *first = tl_val_num(s->from);
+      *rest = tl_seq_range(s->from + s->step, s->to, s->step);
+      return NULL;
+
+    case TL_SEQ_REPEAT:
+      if (s->to == 0) return NULL;
+      *first = tl_val_copy(s->x);
+      *rest = tl_seq_repeat(s->x, s->to < 0 ? -1 : s->to - 1);
+      return NULL;
+
+    case TL_SEQ_ITERATE: {
+      Value* x = s->step ? tl_builtin_apply(e, s->fn, 1, &s->x) : tl_val_copy(s->x);
+      if (x->type == TL_ERROR) return x;
+
+      Seq* r = tl_seq_alloc(TL_SEQ_ITERATE);
+      r->fn = tl_val_copy(s->fn);
+      r->x = tl_val_copy(x);
+      r->step = 1;
+      *first = x;
+      *rest = r;
+      return NULL;
+    }
+
+    case TL_SEQ_MAP: {
+      Value* y;
+      Seq* r;
+      Value* err = tl_seq_uncons(s->src, e, &y, &r);
+      if (err || !y) return err;
+
+      Value* z = tl_builtin_apply(e, s->fn, 1, &y);
+      tl_val_delete(y);
+      if (z->type == TL_ERROR) {
+        tl_seq_release(r);
+        return z;
+      }
+      *first = z;
+      *rest = tl_seq_map(TL_SEQ_MAP, s->fn, r);
+      return NULL;
+    }
+
+    case TL_SEQ_FILTER: {
+      Seq* src = s->src;
+      src->refs++;
+      while (1) {
+        Value* y;
+        Seq* r;
+        Value* err = tl_seq_uncons(src, e, &y, &r);
+        tl_seq_release(src);
+        if (err || !y) return err;
+
+        Value* t = tl_builtin_apply(e, s->fn, 1, &y);
+        if (t->type != TL_INTEGER) {
+          tl_val_delete(y);
+          tl_seq_release(r);
+          if (t->type == TL_ERROR) return t;
+          Value* err = tl_val_error(
+              "Function 'filter' predicate returned incorrect type. Got %s, expected %s",
+              tl_type_name(t->type), tl_type_name(TL_INTEGER));
+          tl_val_delete(t);
+          return err;
+        }
+
+        int keep = t->num != 0;
+        tl_val_delete(t);
+        if (keep) {
+          *first = y;
+          *rest = tl_seq_map(TL_SEQ_FILTER, s->fn, r);
+          return NULL;
+        }
+        tl_val_delete(y);
+        src = r;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Forces node 's' in place, storing its first element and the rest.
+ * Returns an error, or NULL. */
+Value* tl_seq_force(Seq* s, Env* e) {
+  if (s->kind == TL_SEQ_CELL) return NULL;
+
+  // Held while user code runs, which may drop every other reference
+  s->refs++;
+  Value* first;
+  Seq* rest;
+  Value* err = tl_seq_uncons(s, e, &first, &rest);
+
+  if (!err && s->kind != TL_SEQ_CELL) {
+    tl_seq_clear(s);
+    s->kind = TL_SEQ_CELL;
+    s->first = first;
+    s->rest = rest;
+  } else if (!err && first) {
+    tl_val_delete(first);
+    tl_seq_release(rest);
+  }
+
+  tl_seq_release(s);
+  return err;
+}
+
+/* Moves cursor '*s', which holds a reference, on by one element. Sets
+ * '*x' to the element, or to NULL at the end. Returns an error, or NULL.
+ * Nothing is stored in nodes the cursor has not already found forced. */
+Value* tl_seq_next(Seq** s, Env* e, Value** x) {
+  // A range node only the cursor holds is simply advanced
+  Seq* c = *s;
+  if (c->kind == TL_SEQ_RANGE && c->refs == 1) {
+    int end = c->step > 0 ? c->from >= c->to : c->from <= c->to;
+    *x = end ? NULL : tl_val_num(c->from);
+    if (!end) c->from += c->step;
+    return NULL;
+  }
+
+  Seq* rest;
+  Value* err = tl_seq_uncons(*s, e, x, &rest);
+  if (err || !*x) return err;
+
+  tl_seq_release(*s);
+  *s = rest;
+  return NULL;
+}
@@ -0,0 +1,51 @@
+
+#ifndef SEQ_H_INCLUDED_
+#define SEQ_H_INCLUDED_
+
+#include "value.h"
+
+/* A lazy sequence is a chain of nodes. A node that has not been forced
+ * holds the state that produces it; forcing it with 'head' or 'tail'
+ * stores its first element and the node of the rest in its place, so
+ * it is only worked out once. Nodes are shared between copies.
+ *
+ * Walks over a whole sequence use a cursor instead, which steps unforced
+ * nodes without storing what it passes, so memory stays bounded even
+ * while the sequence itself is still referenced. */
+
+enum { TL_SEQ_CELL, TL_SEQ_RANGE, TL_SEQ_ITERATE, TL_SEQ_REPEAT,
+       TL_SEQ_MAP, TL_SEQ_FILTER };
+
+struct tl_seq {
+  int refs;
+  int kind;
+
+  // TL_SEQ_CELL: 'first' then 'rest', or the end when 'first' is NULL
+  Value* first;
+  Seq* rest;
+
+  // TL_SEQ_RANGE: 'from' up to 'to' by 'step'
+  // TL_SEQ_REPEAT: 'x' for 'to' more times, or forever when 'to' < 0
+  long from;
+  long to;
+  long step;
+
+  // TL_SEQ_ITERATE: 'x', then 'fn' applied to it; 'step' is set once
+  // 'fn' is still to be applied to 'x'
+  // TL_SEQ_MAP, TL_SEQ_FILTER: 'fn' over the elements of 'src'
+  Value* fn;
+  Value* x;
+  Seq* src;
+};
+
+Value* tl_seq_new(Seq*);
+Seq*   tl_seq_range(long, long, long);
+Seq*   tl_seq_iterate(Value*, Value*);
+Seq*   tl_seq_repeat(Value*, long);
+Seq*   tl_seq_map(int, Value*, Seq*);
+void   tl_seq_release(Seq*);
+
+Value* tl_seq_force(Seq*, Env*);
+Value* tl_seq_next(Seq**, Env*, Value**);
+
+#endif
@@ -1,6 +1,12 @@
 
 #include "value.h"
 #include "builtins.h"
+#include "machine.h"
+#include "seq.h"
+#include "memo.h"
+#include "intern.h"
+#include "match.h"
+#include "record.h"
 
 Value* tl_val_num(long x) {
   Value* v = malloc(sizeof(Value));
@@ -20,6 +26,8 @@ Value* tl_val_string(char* s) {
 Value* tl_val_error(char* fmt, ...) {
   Value* v = malloc(sizeof(Value));
   v->type = TL_ERROR;
+  v->num = 0;
+  v->body = NULL;
 
   va_list va;
   va_start(va, fmt);
@@ -36,6 +44,7 @@ Value* tl_val_error(char* fmt, ...) {
 Value* tl_val_symbol(char* s) {
   Value* v = malloc(sizeof(Value));
   v->type = TL_SYMBOL;
+  v->num = 0;
   v->sym = malloc(strlen(s)+1);
   strcpy(v->sym, s);
   return v;
@@ -46,6 +55,9 @@ Value* tl_val_sexpr(void) {
   v->type = TL_SEXPR;
   v->count = 0;
   v->cell = NULL;
+  v->intern = NULL;
+  v->match = NULL;
+  v->unboxed = 0;
   return v;
 }
 
@@ -54,6 +66,9 @@ Value* tl_val_qexpr(void) {
   v->type = TL_QEXPR;
   v->count = 0;
   v->cell = NULL;
+  v->intern = NULL;
+  v->match = NULL;
+  v->unboxed = 0;
   return v;
 }
 
@@ -62,48 +77,67 @@ Value* tl_val_lambda(Value* formals, Value* body) {
   v->type = TL_FUNCTION;
 
   v->builtin = NULL;
+  v->partial = NULL;
+  v->memo = NULL;
+  v->num = 0;
+  v->macro = 0;
   v->env = tl_env_new();
 
   v->formals = formals;
   v->body = body;
+  body->refs = 1;
 
   return v;
 }
 
-Value* tl_val_call(Env* e, Value* fn, Value* args) {
-  if(fn->builtin) { return fn->builtin(e, args); }
+static void tl_val_release_body(Value* body) {
+  if (--body->refs == 0) tl_val_delete(body);
+}
+
+/* Gives lambda 'fn' the body 'body', which it takes, in place of the one
+ * it may share with its copies. */
+void tl_val_body(Value* fn, Value* body) {
+  tl_val_release_body(fn->body);
+  fn->body = body;
+  body->refs = 1;
+}
 
-  int given = args->count;
+/* Binds arguments 'a' to the formals of 'fn', taking ownership of every
+ * argument it consumes and clearing its slot. */
+Value* tl_val_bind(Env* e, Value* fn, int n, Value** a) {
   int total = fn->formals->count;
 
-  while (args->count) {
+  for (int i=0; i < n; i++) {
     if (fn->formals->count == 0) {
-      tl_val_delete(args);
       return tl_val_error(
           "Function passed too many arguments. "
-          "Got %i, expected %i.", given, total);
+          "Got %i, expected %i.", n, total);
     }
 
     Value* sym = tl_val_pop(fn->formals, 0);
 
     if (strcmp(sym->sym, "&") == 0) {
       if (fn->formals->count != 1) {
-        tl_val_delete(args);
+        tl_val_delete(sym);
         return tl_val_error("Function format invalid."
             "Symbol '&' not followed by single symbol");
       }
 
       Value* symbols = tl_val_pop(fn->formals, 0);
-      tl_env_put(fn->env, symbols, builtin_list(e, args));
+      Value* rest = tl_val_qexpr();
+      for (; i < n; i++) {
+        tl_val_add(rest, a[i]);
+        a[i] = NULL;
+      }
+      tl_env_set(fn->env, symbols, rest);
       tl_val_delete(sym);
       tl_val_delete(symbols);
       break;
     }
 
-    Value* val = tl_val_pop(args, 0);
-    tl_env_put(fn->env, sym, val);
+    tl_env_set(fn->env, sym, a[i]);
+    a[i] = NULL;
     tl_val_delete(sym);
-    tl_val_delete(val);
   }
 
   if (fn->formals->count > 0 && strcmp(fn->formals->cell[0]->sym, "&") == 0) {
@@ -114,24 +148,57 @@ Value* tl_val_call(Env* e, Value* fn, Value* args) {
 
     tl_val_delete(tl_val_pop(fn->formals, 0));
     Value* symbol = tl_val_pop(fn->formals, 0);
-    Value* value  = tl_val_qexpr();
-
-    tl_env_put(e, symbol, value);
+    tl_env_set(fn->env, symbol, tl_val_qexpr());
     tl_val_delete(symbol);
-    tl_val_delete(value);
   }
 
-  tl_val_delete(args);
+  return NULL;
+}
 
-  if (fn->formals->count == 0) {
-    // Eval and return if all formals have been bound
-    fn->env->parent = e;
-    return builtin_eval(fn->env,
-        tl_val_add(tl_val_sexpr(), tl_val_copy(fn->body)));
-  } else {
-    // Partially evaluated function
-    return tl_val_copy(fn);
+/* Wraps lambda 'fn' applied to 'n' arguments, taking ownership of both
+ * and clearing the argument slots. */
+Value* tl_val_partial(Value* fn, int n, Value** a) {
+  Partial* p = malloc(sizeof(Partial));
+  p->refs = 1;
+  p->fn = fn;
+  p->count = n;
+  p->args = malloc(sizeof(Value*) * n);
+  for (int i=0; i < n; i++) {
+    p->args[i] = a[i];
+    a[i] = NULL;
   }
+
+  Value* v = malloc(sizeof(Value));
+  v->type = TL_FUNCTION;
+  v->builtin = NULL;
+  v->partial = p;
+  v->memo = NULL;
+  return v;
+}
+
+/* Returns a fresh copy of the lambda under partial application 'fn',
+ * with the arguments supplied so far bound. */
+Value* tl_val_unpartial(Value* fn) {
+  Partial* p = fn->partial;
+  Value* x = p->fn->partial ? tl_val_unpartial(p->fn) : tl_val_copy(p->fn);
+  for (int i=0; i < p->count; i++) {
+    Value* a = tl_val_copy(p->args[i]);
+    tl_val_bind(NULL, x, 1, &a);
+  }
+  return x;
+}
+
+// Arguments a lambda needs before it runs, less any already supplied
+int tl_val_arity(Value* fn) {
+  if (fn->partial) return tl_val_arity(fn->partial->fn) - fn->partial->count;
+
+  int n = 0;
+  while (n < fn->formals->count && strcmp(fn->formals->cell[n]->sym, "&") != 0) n++;
+  return n;
+}
+
+Value* tl_val_call(Env* e, Value* fn, int n, Value** a) {
+  return tl_machine_apply(e, fn, n, a);
 }
 
 void tl_val_print_string(Value* v) {
@@ -169,8 +236,15 @@ void tl_val_print(Value* v) {
       break;
 
     case TL_FUNCTION:
-      if (v->builtin) {
+      if (v->builtin || v->memo) {
         printf("<function>");
+      } else if (!v->partial && v->macro) {
+        printf("<macro>");
+      } else if (v->partial) {
+        // Shown as the lambda of the formals still to be supplied
+        Value* x = tl_val_unpartial(v);
+        tl_val_print(x);
+        tl_val_delete(x);
       } else {
         printf("(\\ ");
         tl_val_print(v->formals);
@@ -179,12 +253,69 @@ void tl_val_print(Value* v) {
         putchar(')');
       }
       break;
+
+    case TL_GENERATOR:
+      printf("<generator>");
+      break;
+
+    case TL_SEQ:
+      printf("<sequence>");
+      break;
+
+    case TL_RECORD:
+      // A record as the call to its constructor that makes it
+      if (!v->record->type) {
+        printf("<record %s>", v->record->name);
+        break;
+      }
+      printf("(%s", v->record->type->name);
+      for (int i=0; i < v->record->count; i++) {
+        putchar(' ');
+        tl_val_print(v->record->fields[i]);
+      }
+      putchar(')');
+      break;
+  }
+}
+
+/* Expressions nested deeper than this are deleted, or have their cells
+ * copied, from a list of their own once the outermost call is done with
+ * the rest, rather than on the C stack. */
+#define TL_VAL_DEPTH 4096
+
+typedef struct {
+  int depth;
+  int draining;
+  int count;
+  int size;
+  Value** items;
+} Pending;
+
+static Pending tl_val_deletes = { 0, 0, 0, 0, NULL };
+static Pending tl_val_copies = { 0, 0, 0, 0, NULL };
+
+static void tl_val_defer(Pending* p, Value* v) {
+  if (p->count == p->size) {
+    p->size = p->size ? p->size * 2 : 64;
+    p->items = realloc(p->items, sizeof(Value*) * p->size);
   }
+  p->items[p->count++] = v;
 }
 
 void tl_val_delete(Value* v) {
+  Pending* p = &tl_val_deletes;
+  if (p->depth >= TL_VAL_DEPTH) {
+    tl_val_defer(p, v);
+    return;
+  }
+  p->depth++;
+
   switch(v->type) {
-    case TL_ERROR:   free(v->err); break;
+    case TL_ERROR:
+      free(v->err);
+      if (v->body) tl_val_delete(v->body);
+      break;
+
     case TL_SYMBOL:  free(v->sym); break;
     case TL_STRING:  free(v->str); break;
 
@@ -192,120 +323,122 @@ void tl_val_delete(Value* v) {
 
     case TL_QEXPR:
     case TL_SEXPR:
+      if (v->match) tl_match_release(v->match);
+      if (v->intern) {
+        tl_intern_release(v->intern);
+        break;
+      }
       for(int i=0; i < v->count; i++) tl_val_delete(v->cell[i]);
       free(v->cell);
       break;
 
     case TL_FUNCTION:
-      if (!v->builtin) {
+      if (v->memo) {
+        tl_memo_release(v->memo);
+      } else if (v->partial) {
+        if (--v->partial->refs == 0) {
+          tl_val_delete(v->partial->fn);
+          for (int i=0; i < v->partial->count; i++) tl_val_delete(v->partial->args[i]);
+          free(v->partial->args);
+          free(v->partial);
+        }
+      } else if (!v->builtin) {
         tl_env_delete(v->env);
         tl_val_delete(v->formals);
-        tl_val_delete(v->body);
+        tl_val_release_body(v->body);
       }
       break;
+
+    case TL_GENERATOR:
+      tl_machine_release(v->machine);
+      break;
+
+    case TL_SEQ:
+      tl_seq_release(v->seq);
+      break;
+
+    case TL_RECORD:
+      tl_record_release(v->record);
+      break;
   }
   free(v);
+
+  if (--p->depth == 0 && !p->draining) {
+    p->draining = 1;
+    while (p->count) tl_val_delete(p->items[--p->count]);
+    p->draining = 0;
+  }
+}
+
+/* A 'match' tree refers to its node by position, so is dropped on change,
+ * as is the mark of an unboxed integer operation. */
+static void tl_val_unmatch(Value* v) {
+  v->unboxed = 0;
+  if (!v->match) return;
+  tl_match_release(v->match);
+  v->match = NULL;
 }
 
 Value* tl_val_add(Value* v, Value* x) {
+  if (v->intern) tl_intern_unshare(v);
+  tl_val_unmatch(v);
   v->count++;
   v->cell = realloc(v->cell, sizeof(Value*) * v->count);
   v->cell[v->count - 1] = x;
   return v;
 }
 
-Value* tl_val_read_integer(mpc_ast_t* t) {
-  errno = 0;
-  long x = strtol(t->contents, NULL, 10);
-  return errno != ERANGE ? tl_val_num(x) : tl_val_error("Invalid number");
-}
-
-Value* tl_val_read_str(mpc_ast_t* t) {
-  t->contents[strlen(t->contents)-1] = '\0';
-  char* unescaped = malloc(strlen(t->contents+1)+1);
-  strcpy(unescaped, t->contents+1);
-  unescaped = mpcf_unescape(unescaped);
-  Value* str = tl_val_string(unescaped);
-  free(unescaped);
-  return str;
-}
-
-Value* tl_val_read(mpc_ast_t* t) {
-  if (strstr(t->tag, "number")) { return tl_val_read_integer(t); }
-  if (strstr(t->tag, "symbol")) { return tl_val_symbol(t->contents); }
-
-  Value* x = NULL;
-  if (strcmp(t->tag, ">") == 0) { x = tl_val_sexpr();  }
-  if (strstr(t->tag, "sexpr")) { x = tl_val_sexpr(); }
-  if (strstr(t->tag, "qexpr")) { x = tl_val_qexpr(); }
-  if (strstr(t->tag, "string")) { return tl_val_read_str(t); }
-
-  for(int i = 0; i<t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) continue;
-    if (strcmp(t->children[i]->contents, ")") == 0) continue;
-    if (strcmp(t->children[i]->contents, "{") == 0) continue;
-    if (strcmp(t->children[i]->contents, "}") == 0) continue;
-    if (strcmp(t->children[i]->tag,  "regex") == 0) continue;
-    if (strstr(t->children[i]->tag, "comment")) { continue; }
-
-    x = tl_val_add(x, tl_val_read(t->children[i]));
-  }
-  return x;
-}
-
+/* Nested expressions are printed from a stack of their own, with the
+ * next cell of each, as they can nest too deeply for the C stack. */
 void tl_val_print_expr(Value* v, char open, char close) {
+  int count = 1;
+  int size = 16;
+  Value** exprs = malloc(sizeof(Value*) * size);
+  int* next = malloc(sizeof(int) * size);
+  exprs[0] = v;
+  next[0] = 0;
   putchar(open);
   putchar(' ');
-  for(int i=0; i<v->count; i++) {
-    tl_val_print(v->cell[i]);
-    if (i != (v->count - 1)) putchar(' ');
-  }
-  putchar(' ');
-  putchar(close);
-}
-
-Value* tl_val_eval_sexpr(Env* e, Value* v) {
-  for(int i=0; i < v->count; i++)
-    v->cell[i] = tl_val_eval(e, v->cell[i]);
 
-  for(int i=0; i < v->count; i++)
-    if (v->cell[i]->type == TL_ERROR)
-      return tl_val_take(v, i);
-
-  if (v->count == 0) return v;
-
-  if (v->count == 1) return tl_val_take(v, 0);
+  while (count) {
+    Value* x = exprs[count-1];
+    int i = next[count-1]++;
+    if (i == x->count) {
+      putchar(' ');
+      putchar(count == 1 ? close : x->type == TL_SEXPR ? ')' : '}');
+      count--;
+      continue;
+    }
+    if (i) putchar(' ');
 
-  Value* f = tl_val_pop(v, 0);
-  if (f->type != TL_FUNCTION) {
-    Value* err = tl_val_error(
-        "S-expression starts with incorrect type. "
-        "Got %s, expected %s.",
-        tl_type_name(f->type), tl_type_name(TL_FUNCTION));
-    tl_val_delete(f);
-    tl_val_delete(v);
-    return err;
+    Value* y = x->cell[i];
+    if (y->type != TL_SEXPR && y->type != TL_QEXPR) {
+      tl_val_print(y);
+      continue;
+    }
+    if (count == size) {
+      size *= 2;
+      exprs = realloc(exprs, sizeof(Value*) * size);
+      next = realloc(next, sizeof(int) * size);
+    }
+    exprs[count] = y;
+    next[count++] = 0;
+    putchar(y->type == TL_SEXPR ? '(' : '{');
+    putchar(' ');
   }
 
-  Value* result = tl_val_call(e, f, v);
-  tl_val_delete(f);
-  return result;
+  free(exprs);
+  free(next);
 }
 
 Value* tl_val_eval(Env* e, Value* v) {
-  if (v->type == TL_SYMBOL) {
-    Value* x = tl_env_get(e, v);
-    tl_val_delete(v);
-    return x;
-  }
-
-  if (v->type == TL_SEXPR)
-    return tl_val_eval_sexpr(e, v);
-
-  return v;
+  if (v->type != TL_SYMBOL && v->type != TL_SEXPR) return v;
+  return tl_machine_eval(e, v);
 }
 
 Value* tl_val_pop(Value* v, int i) {
+  if (v->intern) tl_intern_unshare(v);
+  tl_val_unmatch(v);
   Value* x = v->cell[i];
   memmove(&v->cell[i], &v->cell[i+1], sizeof(Value*)*(v->count-i-1));
   v->count--;
@@ -326,16 +459,29 @@ Value* tl_val_join(Value* x, Value* y) {
   return x;
 }
 
-Value* tl_val_fun(tl_builtin func) {
+Value* tl_val_fun(Builtin* b) {
   Value* v = malloc(sizeof(Value));
   v->type = TL_FUNCTION;
-  v->builtin = func;
+  v->builtin = b;
+  v->partial = NULL;
+  v->memo = NULL;
+  v->num = 0;
   return v;
 }
 
 Value* tl_val_copy(Value* v) {
+  if ((v->type == TL_QEXPR || v->type == TL_SEXPR) && v->intern) {
+    Value* x = tl_intern_copy(v);
+    x->match = v->match;
+    x->unboxed = v->unboxed;
+    if (x->match) x->match->refs++;
+    return x;
+  }
+
   Value* x = malloc(sizeof(Value));
   x->type = v->type;
+  Pending* p = &tl_val_copies;
+  p->depth++;
 
   switch(v->type) {
     case TL_INTEGER:  x->num = v->num; break;
@@ -343,9 +489,12 @@ Value* tl_val_copy(Value* v) {
     case TL_ERROR:
       x->err = malloc(strlen(v->err)+1);
       strcpy(x->err, v->err);
+      x->num = v->num;
+      x->body = v->body ? tl_val_copy(v->body) : NULL;
       break;
 
     case TL_SYMBOL:
+      x->num = v->num;
       x->sym = malloc(strlen(v->sym)+1);
       strcpy(x->sym, v->sym);
       break;
@@ -358,21 +507,68 @@ Value* tl_val_copy(Value* v) {
     case TL_SEXPR:
     case TL_QEXPR:
       x->count = v->count;
+      x->intern = NULL;
+      x->match = v->match;
+      x->unboxed = v->unboxed;
+      if (x->match) x->match->refs++;
       x->cell = malloc(sizeof(Value*) * v->count);
+      if (p->depth > TL_VAL_DEPTH) {
+        // Left for the outermost call to fill in, from 'v' kept alongside
+        tl_val_defer(p, v);
+        tl_val_defer(p, x);
+        break;
+      }
       for (int i=0; i < x->count; i++)
         x->cell[i] = tl_val_copy(v->cell[i]);
       break;
 
     case TL_FUNCTION:
+      x->partial = v->partial;
+      x->memo = v->memo;
       if (v->builtin) {
-        x->builtin = v->builtin; break;
+        x->builtin = v->builtin;
+        x->num = v->num;
+      } else if (v->memo) {
+        x->builtin = NULL;
+        x->memo->refs++;
+      } else if (v->partial) {
+        x->builtin = NULL;
+        x->partial->refs++;
       } else {
         x->builtin = NULL;
+        x->num = v->num;
+        x->macro = v->macro;
         x->env = tl_env_copy(v->env);
         x->formals = tl_val_copy(v->formals);
-        x->body = tl_val_copy(v->body);
+        x->body = v->body;
+        x->body->refs++;
       }
       break;
+
+    case TL_GENERATOR:
+      x->machine = v->machine;
+      x->machine->refs++;
+      break;
+
+    case TL_SEQ:
+      x->seq = v->seq;
+      x->seq->refs++;
+      break;
+
+    case TL_RECORD:
+      x->record = v->record;
+      x->record->refs++;
+      break;
+  }
+
+  if (--p->depth == 0 && !p->draining) {
+    p->draining = 1;
+    while (p->count) {
+      Value* to = p->items[--p->count];
+      Value* from = p->items[--p->count];
+      for (int i=0; i < to->count; i++) to->cell[i] = tl_val_copy(from->cell[i]);
+    }
+    p->draining = 0;
   }
   return x;
 }
@@ -389,31 +585,33 @@ Env* tl_env_new(void) {
 void tl_env_delete(Env* e) {
   for(int i=0; i < e->count; i++) {
     free(e->syms[i]);
-    free(e->vals[i]);
+    tl_val_delete(e->vals[i]);
   }
   free(e->syms);
   free(e->vals);
   free(e);
 }
 
-Value* tl_env_get(Env* e, Value* v) {
-  for(int i=0; i < e->count; i++) {
-    if (strcmp(e->syms[i], v->sym) == 0)
-      return tl_val_copy(e->vals[i]);
+Value* tl_env_lookup(Env* e, Value* v) {
+  for (; e; e = e->parent) {
+    for(int i=0; i < e->count; i++) {
+      if (strcmp(e->syms[i], v->sym) == 0) return e->vals[i];
+    }
   }
+  return NULL;
+}
 
-  if (e->parent) {
-    return tl_env_get(e->parent, v);
-  } else {
-    return tl_val_error("Unbound symbol '%s'", v->sym);
-  }
+Value* tl_env_get(Env* e, Value* v) {
+  Value* x = tl_env_lookup(e, v);
+  return x ? tl_val_copy(x) : tl_val_error("Unbound symbol '%s'", v->sym);
 }
 
-void tl_env_put(Env* e, Value* s, Value* v) {
+// Stores 'v' under 's', taking ownership of 'v'
+void tl_env_set(Env* e, Value* s, Value* v) {
   for(int i=0; i < e->count; i++) {
     if (strcmp(e->syms[i], s->sym) == 0) {
       tl_val_delete(e->vals[i]);
-      e->vals[i] = tl_val_copy(v);
+      e->vals[i] = v;
       return;
     }
   }
@@ -422,11 +620,16 @@ void tl_env_put(Env* e, Value* s, Value* v) {
   e->vals = realloc(e->vals, sizeof(Value*) * e->count);
   e->syms = realloc(e->syms, sizeof(char*) * e->count);
 
-  e->vals[e->count - 1] = tl_val_copy(v);
+  e->vals[e->count - 1] = v;
   e->syms[e->count - 1] = malloc(strlen(s->sym)+1);
   strcpy(e->syms[e->count - 1], s->sym);
 }
 
+void tl_env_put(Env* e, Value* s, Value* v) {
+  // Copy first, 'v' may be the value being replaced
+  tl_env_set(e, s, tl_val_copy(v));
+}
+
 void tl_env_def(Env* e, Value* k, Value* v) {
   while (e->parent) e = e->parent;
   tl_env_put(e, k, v);
@@ -446,48 +649,49 @@ Env* tl_env_copy(Env* e) {
   return n;
 }
 
-void tl_env_add_builtin(Env* e, char* name, tl_builtin func) {
+/* Moves the bindings of 'from' that 'e' does not shadow into 'e'. The
+ * rest are left in 'from' to be deleted with it. */
+void tl_env_merge(Env* e, Env* from) {
+  int n = e->count, k = 0;
+  for (int i=0; i < from->count; i++) {
+    int shadowed = 0;
+    for (int j=0; j < n && !shadowed; j++) shadowed = strcmp(e->syms[j], from->syms[i]) == 0;
+    if (shadowed) {
+      from->syms[k] = from->syms[i];
+      from->vals[k++] = from->vals[i];
+      continue;
+    }
+    e->count++;
+    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+    e->vals = realloc(e->vals, sizeof(Value*) * e->count);
+    e->syms[e->count - 1] = from->syms[i];
+    e->vals[e->count - 1] = from->vals[i];
+  }
+  from->count = k;
+}
+
+void tl_env_add_builtin(Env* e, char* name, Builtin* b) {
   Value* s = tl_val_symbol(name);
-  Value* f = tl_val_fun(func);
-  tl_env_put(e, s, f);
+  tl_env_set(e, s, tl_val_fun(b));
   tl_val_delete(s);
-  tl_val_delete(f);
 }
 
 void tl_env_add_builtins(Env* e) {
-  tl_env_add_builtin(e, "list", builtin_list);
-  tl_env_add_builtin(e, "head", builtin_head);
-  tl_env_add_builtin(e, "tail", builtin_tail);
-  tl_env_add_builtin(e, "eval", builtin_eval);
-  tl_env_add_builtin(e, "join", builtin_join);
-
-  tl_env_add_builtin(e, "+", builtin_add);
-  tl_env_add_builtin(e, "-", builtin_subtract);
-  tl_env_add_builtin(e, "*", builtin_multiply);
-  tl_env_add_builtin(e, "/", builtin_divide);
-
-  tl_env_add_builtin(e, "def", builtin_def);
-  tl_env_add_builtin(e, "=",   builtin_put);
-  tl_env_add_builtin(e, "\\",  builtin_lambda);
-
-  // Comparison
-  tl_env_add_builtin(e, "if", builtin_if);
-  tl_env_add_builtin(e, "==", builtin_eq);
-  tl_env_add_builtin(e, "!=", builtin_ne);
-  tl_env_add_builtin(e, ">",  builtin_gt);
-  tl_env_add_builtin(e, "<",  builtin_lt);
-  tl_env_add_builtin(e, ">=", builtin_ge);
-  tl_env_add_builtin(e, "<=", builtin_le);
+  for (Builtin* b = tl_builtins; b->fn; b++) tl_env_add_builtin(e, b->name, b);
 }
 
 char* tl_type_name(int t) {
   switch(t) {
-    case TL_FUNCTION: return "Function";
-    case TL_INTEGER:  return "Number";
-    case TL_ERROR:    return "Error";
-    case TL_SYMBOL:   return "Symbol";
-    case TL_SEXPR:    return "S-expression";
-    case TL_QEXPR:    return "Q-expression";
-    default:          return "Unknown";
+    case TL_FUNCTION:  return "Function";
+    case TL_INTEGER:   return "Number";
+    case TL_ERROR:     return "Error";
+    case TL_SYMBOL:    return "Symbol";
+    case TL_SEXPR:     return "S-expression";
+    case TL_QEXPR:     return "Q-expression";
+    case TL_GENERATOR: return "Generator";
+    case TL_SEQ:       return "Sequence";
+    case TL_RECORD:    return "Record";
+    case TL_STRING:    return "String";
+    default:           return "Unknown";
   }
 }
@@ -7,8 +7,32 @@
 
 typedef struct value Value;
 typedef struct tl_env Env;
-
-typedef Value*(*tl_builtin)(Env*, Value*);
+typedef struct tl_machine Machine;
+typedef struct tl_partial Partial;
+typedef struct tl_seq Seq;
+typedef struct tl_memo Memo;
+typedef struct tl_intern Intern;
+typedef struct tl_match Match;
+typedef struct tl_record Record;
+
+typedef Value*(*tl_builtin)(Env*, int, Value**);
+
+/* Describes a builtin: its arity and the types of its arguments. 'types'
+ * holds one letter per argument (n number, s string, q Q-expression,
+ * l Q-expression or lazy sequence, f function, g generator, . anything)
+ * and its last letter also covers any further arguments. A 'max' of -1
+ * means variadic. */
+typedef struct {
+  char* name;
+  tl_builtin fn;
+  int min;
+  int max;
+  char* types;
+  int flags;
+} Builtin;
+
+// Builtins that neither evaluate code nor change an environment
+enum { TL_PURE = 1 };
 
 struct value {
   int type;
@@ -18,13 +42,36 @@ struct value {
   char* sym;
   char* str;
 
-  tl_builtin builtin;
+  Builtin* builtin;
   Env* env;
   Value* formals;
   Value* body;
+  int macro;
 
   int count;
   struct value** cell;
+  Intern* intern;
+  Match* match;
+  int unboxed;
+
+  // A lambda body is shared by the copies of its lambda, which it counts
+  int refs;
+
+  Machine* machine;
+  Partial* partial;
+  Memo* memo;
+  Seq* seq;
+  Record* record;
+};
+
+/* A lambda applied to fewer arguments than it takes. 'fn' is the lambda,
+ * or an earlier partial application of it, and is shared by every copy
+ * rather than copied along with it. */
+struct tl_partial {
+  int refs;
+  Value* fn;
+  int count;
+  Value** args;
 };
 
 struct tl_env {
@@ -34,24 +81,30 @@ struct tl_env {
   Value** vals;
 };
 
-enum { TL_INTEGER, TL_STRING, TL_ERROR, TL_SYMBOL, TL_SEXPR, TL_QEXPR, TL_FUNCTION };
+enum { TL_INTEGER, TL_STRING, TL_ERROR, TL_SYMBOL, TL_SEXPR, TL_QEXPR, TL_FUNCTION,
+       TL_GENERATOR, TL_SEQ, TL_RECORD };
 
 Value* tl_val_num(long);
 Value* tl_val_string(char*);
 Value* tl_val_error(char*, ...);
+Value* tl_val_symbol(char*);
 Value* tl_val_lambda(Value*, Value*);
+void   tl_val_body(Value*, Value*);
 Value* tl_val_sexpr();
+Value* tl_val_qexpr();
 
 Value* tl_val_add(Value*, Value*);
-Value* tl_val_read(mpc_ast_t*);
 Value* tl_val_pop(Value*, int);
 Value* tl_val_take(Value*, int);
 Value* tl_val_eval(Env*, Value*);
-Value* tl_val_eval_sexpr(Env*, Value*);
 Value* tl_val_join(Value*, Value*);
-Value* tl_val_fun(tl_builtin);
+Value* tl_val_fun(Builtin*);
+Value* tl_val_partial(Value*, int, Value**);
+Value* tl_val_unpartial(Value*);
+int    tl_val_arity(Value*);
 Value* tl_val_copy(Value*);
-Value* tl_val_call(Env*, Value*, Value*);
+Value* tl_val_bind(Env*, Value*, int, Value**);
+Value* tl_val_call(Env*, Value*, int, Value**);
 
 void tl_val_print(Value*);
 void tl_val_print_expr(Value*, char, char);
@@ -60,11 +113,14 @@ void tl_val_delete(Value*);
 Env*   tl_env_new(void);
 void   tl_env_delete(Env*);
 Value* tl_env_get(Env*, Value*);
+Value* tl_env_lookup(Env*, Value*);
 void   tl_env_put(Env*, Value*, Value*);
+void   tl_env_set(Env*, Value*, Value*);
 void   tl_env_def(Env*, Value*, Value*);
 Env*   tl_env_copy(Env*);
+void   tl_env_merge(Env*, Env*);
 
-void   tl_env_add_builtin(Env*, char*, tl_builtin);
+void   tl_env_add_builtin(Env*, char*, Builtin*);
 void   tl_env_add_builtins(Env*);
 
 char* tl_type_name(int);